@@ -9,12 +9,19 @@
  */
 
 #include "pin.H"
+#include "HW1.h"
 #include <iostream>
 #include <fstream>
-#include <unordered_set>
-#include <map>
 #include <algorithm>
 #include <limits>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstdlib>
+#include <new>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
 using std::cerr;
 using std::endl;
 using std::string;
@@ -23,39 +30,159 @@ using std::string;
 // Global variables
 /* ================================================================== */
 
-UINT64 insCount    = 0; //number of dynamically executed instructions
-UINT64 bblCount    = 0; //number of dynamically executed basic blocks
 UINT64 threadCount = 0; //total number of threads, including main thread
 
-static UINT64 icount = 0;
+static UINT64 icount = 0;                       // instructions published by all threads, see CountBbl()
 static UINT64 fast_forward_count = 0;
-static UINT64 g_loads = 0;
-static UINT64 g_stores = 0;
-static UINT64 g_nops = 0;
-static UINT64 g_direct_calls = 0;
-static UINT64 g_indirect_calls = 0;
-static UINT64 g_returns = 0;
-static UINT64 g_unconditional_branches = 0;
-static UINT64 g_conditional_branches = 0;
-static UINT64 g_logical_operations = 0;
-static UINT64 g_rotate_shift = 0;
-static UINT64 g_flag_operations = 0;
-static UINT64 g_vector_instructions = 0;
-static UINT64 g_conditional_moves = 0;
-static UINT64 g_mmx_sse = 0;
-static UINT64 g_system_calls = 0;
-static UINT64 g_floating_point = 0;
-static UINT64 g_others = 0;
+static const UINT64 WINDOW_LENGTH = 1000000000; // instructions analysed after the fast-forward
+static const UINT64 ICOUNT_BATCH = 16384;       // instructions a thread counts privately before publishing
+
+/*!
+ * Instrumentation phases.
+ * PHASE_GUARDED guards every analysis call with FastForward() for the whole run.
+ * In two-phase mode the tool starts in PHASE_FAST_FORWARD, where each basic block
+ * only counts instructions, and re-instruments into PHASE_DETAILED once the fast-forward
+ * count is crossed; detailed code runs its analysis calls without any guard.
+ * With a region of interest the tool stays in PHASE_ROI, where the analysis
+ * calls are guarded by InRoi() instead and the window is every execution of
+ * the region until the application exits.
+ * In sampling mode the tool stays in PHASE_SAMPLED: every trace has a fast
+ * version counting instructions only and a detailed version with unguarded
+ * analysis calls, and each thread switches between them through versionReg.
+ */
+enum PHASE
+{
+    PHASE_GUARDED,
+    PHASE_FAST_FORWARD,
+    PHASE_DETAILED,
+    PHASE_ROI,
+    PHASE_SAMPLED
+};
+static PHASE phase = PHASE_GUARDED;
+
+/*!
+ * Sums over the samples of a thread, for the mean and confidence interval of the
+ * sampled share of each Part A category (entries 0..NUM_INS_TYPES-1) and of the
+ * CPI (entry NUM_INS_TYPES).
+ */
+struct SAMPLE_STATS
+{
+    UINT64 samples;
+    double sum[NUM_INS_TYPES + 1];
+    double sumSq[NUM_INS_TYPES + 1];
+};
+
+// Part B latencies
+static const UINT32 MEM_OP_LATENCY = 70;
+static const UINT32 INS_LATENCY = 1;
+
+/*!
+ * Part A counter and Part B latency an instruction category is charged to.
+ */
+struct CATEGORY_SLOT
+{
+    INS_TYPE type;
+    UINT32 latency;
+};
+
+struct CATEGORY_ENTRY
+{
+    xed_category_enum_t category;
+    CATEGORY_SLOT slot;
+};
+
+/*!
+ * Type A classification of the XED categories; any category not listed here is
+ * counted as "The rest". Calls are listed as indirect and split off as direct
+ * in CategorizeIns(), the only check that needs more than the category.
+ */
+static constexpr CATEGORY_ENTRY categoryTable[] = {
+    { XED_CATEGORY_NOP,         { TYPE_NOP,             INS_LATENCY } },
+    { XED_CATEGORY_CALL,        { TYPE_INDIRECT_CALL,   INS_LATENCY } },
+    { XED_CATEGORY_RET,         { TYPE_RETURN,          INS_LATENCY } },
+    { XED_CATEGORY_UNCOND_BR,   { TYPE_UNCOND_BR,       INS_LATENCY } },
+    { XED_CATEGORY_COND_BR,     { TYPE_COND_BR,         INS_LATENCY } },
+    { XED_CATEGORY_LOGICAL,     { TYPE_LOGICAL,         INS_LATENCY } },
+    { XED_CATEGORY_ROTATE,      { TYPE_ROTATE_SHIFT,    INS_LATENCY } },
+    { XED_CATEGORY_SHIFT,       { TYPE_ROTATE_SHIFT,    INS_LATENCY } },
+    { XED_CATEGORY_FLAGOP,      { TYPE_FLAGOP,          INS_LATENCY } },
+    { XED_CATEGORY_AVX,         { TYPE_VECTOR,          INS_LATENCY } },
+    { XED_CATEGORY_AVX2,        { TYPE_VECTOR,          INS_LATENCY } },
+    { XED_CATEGORY_AVX2GATHER,  { TYPE_VECTOR,          INS_LATENCY } },
+    { XED_CATEGORY_AVX512,      { TYPE_VECTOR,          INS_LATENCY } },
+    { XED_CATEGORY_CMOV,        { TYPE_CMOV,            INS_LATENCY } },
+    { XED_CATEGORY_MMX,         { TYPE_MMX_SSE,         INS_LATENCY } },
+    { XED_CATEGORY_SSE,         { TYPE_MMX_SSE,         INS_LATENCY } },
+    { XED_CATEGORY_SYSCALL,     { TYPE_SYSCALL,         INS_LATENCY } },
+    { XED_CATEGORY_X87_ALU,     { TYPE_FLOATING_POINT,  INS_LATENCY } },
+};
+
+// categoryTable expanded to one slot per XED category by InitCategorySlots()
+static CATEGORY_SLOT categorySlots[XED_CATEGORY_LAST];
+
+static UINT64 g_counts[NUM_INS_TYPES] = {0};
 static UINT64 cycle_latency = 0;
+static UINT64 mem_cycles = 0;   // load/store cycles under the cache model
+
+/*!
+ * Increments of the Part A counters and the Part B cycle count contributed by one
+ * execution of a basic block (or of a single predicated instruction).
+ * Filled in at instrumentation time and applied by ApplyCountDelta(), which also
+ * counts the executions of the delta for the Part D weighting.
+ */
+struct COUNT_DELTA
+{
+    UINT64 counts[NUM_INS_TYPES];
+    UINT64 cycles;
+    UINT32 id;          // index of the delta's execution counter in THREAD_DATA
+};
+
+/*!
+ * Histogram of small non-negative values: one bucket for each value below
+ * NUM_BUCKETS plus an overflow bucket for everything else, so that an update
+ * is a single indexed increment.
+ */
+template <UINT32 NUM_BUCKETS>
+class HISTOGRAM
+{
+  public:
+    HISTOGRAM() { std::fill(buckets, buckets + NUM_BUCKETS + 1, 0); }
+
+    inline VOID Add(UINT32 value, UINT64 count = 1)
+    {
+        buckets[value < NUM_BUCKETS ? value : NUM_BUCKETS] += count;
+    }
+
+    // Count of a value, 0 for values that fall in the overflow bucket
+    UINT64 operator[](UINT32 value) const { return value < NUM_BUCKETS ? buckets[value] : 0; }
+
+    UINT64 Overflow() const { return buckets[NUM_BUCKETS]; }
+
+    VOID Merge(const HISTOGRAM& other)
+    {
+        for (UINT32 i = 0; i <= NUM_BUCKETS; i++)
+        {
+            buckets[i] += other.buckets[i];
+        }
+    }
+
+  private:
+    UINT64 buckets[NUM_BUCKETS + 1];
+};
+
+// Bucket counts of the Part D histograms
+static const UINT32 MAX_INS_LENGTH = 15;     // longest legal x86 instruction in bytes
+static const UINT32 OPERAND_BUCKETS = 16;    // operand and register operand counts
+static const UINT32 MEM_OPERAND_BUCKETS = 8; // memory operand counts
 
 // Part D statistics
-static std::map<UINT32, UINT64> insLengthDist;        // 1. Instruction length distribution
-static std::map<UINT32, UINT64> operandCountDist;     // 2. Operand count distribution
-static std::map<UINT32, UINT64> regReadDist;          // 3. Register read distribution
-static std::map<UINT32, UINT64> regWriteDist;         // 4. Register write distribution
-static std::map<UINT32, UINT64> memOpDist;            // 5. Memory operand distribution
-static std::map<UINT32, UINT64> memReadDist;          // 6. Memory read distribution
-static std::map<UINT32, UINT64> memWriteDist;         // 7. Memory write distribution
+static HISTOGRAM<MAX_INS_LENGTH + 1> insLengthDist;      // 1. Instruction length distribution
+static HISTOGRAM<OPERAND_BUCKETS> operandCountDist;      // 2. Operand count distribution
+static HISTOGRAM<OPERAND_BUCKETS> regReadDist;           // 3. Register read distribution
+static HISTOGRAM<OPERAND_BUCKETS> regWriteDist;          // 4. Register write distribution
+static HISTOGRAM<MEM_OPERAND_BUCKETS> memOpDist;         // 5. Memory operand distribution
+static HISTOGRAM<MEM_OPERAND_BUCKETS> memReadDist;       // 6. Memory read distribution
+static HISTOGRAM<MEM_OPERAND_BUCKETS> memWriteDist;      // 7. Memory write distribution
 
 // 8. Memory bytes statistics
 static UINT64 maxMemBytes = 0;
@@ -70,499 +197,2907 @@ static INT32 minImm = INT32_MAX;
 static ADDRDELTA maxDisp = std::numeric_limits<ADDRDELTA>::min();
 static ADDRDELTA minDisp = std::numeric_limits<ADDRDELTA>::max();
 
+// Executions of every XED iclass and ISA extension, weighted like Part D
+static UINT64 iclassCounts[XED_ICLASS_LAST];
+static UINT64 extensionCounts[XED_EXTENSION_LAST];
+
+/*!
+ * Part D properties of one static instruction, captured at instrumentation time.
+ * They are weighted by the execution counts of the deltas the instruction belongs
+ * to when the results are reported, so Part D costs nothing at run time.
+ */
+struct INS_RECORD
+{
+    COUNT_DELTA* block;       // applied on every execution of the basic block
+    COUNT_DELTA* predicated;  // applied on executions with a true predicate
+    ADDRINT pc;
+    UINT32 size;
+    UINT32 iclass;            // XED_ICLASS
+    UINT32 extension;         // XED_EXTENSION
+    UINT32 operands;
+    UINT32 regReads;
+    UINT32 regWrites;
+    UINT32 memOperands;
+    UINT32 memReads;
+    UINT32 memWrites;
+    UINT32 memBytes;
+    BOOL hasImm;
+    INT32 minImm;
+    INT32 maxImm;
+    BOOL hasDisp;
+    ADDRDELTA minDisp;
+    ADDRDELTA maxDisp;
+};
+
+static std::vector<INS_RECORD> insRecords;
+
+/*!
+ * An instrumented basic block, for the hot code report. Its executions are those
+ * of its COUNT_DELTA; a block instrumented more than once has several records.
+ */
+struct BLOCK_RECORD
+{
+    ADDRINT addr;
+    UINT32 numIns;
+    COUNT_DELTA* delta;
+};
+
+static std::vector<BLOCK_RECORD> blockRecords;
+
+/*!
+ * Totals of one hot code address in the report, summed over all its records.
+ */
+struct HOT_CODE
+{
+    ADDRINT addr;
+    UINT32 numIns;
+    UINT64 executions;   // block executions or load operand executions
+    UINT64 cycles;
+};
+
 std::ostream* out = &cerr;
 
-// Global unordered sets to store unique 32-byte chunks for footprint measurement
-std::unordered_set<ADDRINT> insChunks;
-std::unordered_set<ADDRINT> dataChunks;
+/*!
+ * Set of touched chunks kept as a page-table-style bitmap.
+ * Every 4 KB page owns a mask with one bit per chunk (128 bits for 32-byte
+ * chunks). Page masks are grouped into leaves covering 4 MB of address space,
+ * which are reached through a two-level radix directory. Canonical x86 addresses
+ * are unique in their low 48 bits, so only those bits are used for the lookup.
+ * Footprints at any coarser power-of-two granularity are derived from the masks
+ * by Count(), so one bitmap serves all granularities.
+ */
+class CHUNK_BITMAP
+{
+  public:
+    static const UINT32 PAGE_BITS  = 12;  // 4 KB pages
+    static const UINT32 LEAF_BITS  = 10;  // pages per leaf
+    static const UINT32 DIR_BITS   = 12;  // leaves per directory
+    static const UINT32 ROOT_BITS  = 48 - PAGE_BITS - LEAF_BITS - DIR_BITS;
+
+    typedef UINT64* LEAF;
+    struct DIR { LEAF leaves[1 << DIR_BITS]; };
+
+    /*!
+     * @param[in]   chunkBits   log2 of the chunk size, at most PAGE_BITS
+     */
+    explicit CHUNK_BITMAP(UINT32 chunkBits)
+        : chunkBits(chunkBits),
+          pageChunkBits(PAGE_BITS - chunkBits),
+          pageWords(std::max(1U, (1U << (PAGE_BITS - chunkBits)) / 64)),
+          numChunks(0),
+          lastPageNum(~0ULL),
+          lastPage(NULL)
+    {
+        std::fill(root, root + (1 << ROOT_BITS), (DIR*)NULL);
+    }
 
-/* ===================================================================== */
-// Command line switches
-/* ===================================================================== */
-KNOB< string > KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "", "specify file name for MyPinTool output");
+    /*!
+     * Mark every chunk touched by the access [addr, addr + size).
+     */
+    inline VOID Insert(ADDRINT addr, UINT32 size)
+    {
+        if (size == 0) return;
+        UINT64 last = ((UINT64)addr + size - 1) >> chunkBits;
+        for (UINT64 chunk = (UINT64)addr >> chunkBits; chunk <= last; chunk++)
+        {
+            TestAndSet(chunk);
+        }
+    }
 
-KNOB< BOOL > KnobCount(KNOB_MODE_WRITEONCE, "pintool", "count", "1",
-                       "count instructions, basic blocks and threads in the application");
+    /*!
+     * Mark a chunk as touched.
+     * @return TRUE if the chunk had not been touched before
+     */
+    inline BOOL TestAndSet(UINT64 chunk)
+    {
+        UINT64 pageNum = chunk >> pageChunkBits;
+        if (pageNum != lastPageNum)
+        {
+            lastPage = FindPage(pageNum);
+            lastPageNum = pageNum;
+        }
+        UINT32 bit = chunk & ((1 << pageChunkBits) - 1);
+        UINT64 mask = 1ULL << (bit & 63);
+        UINT64& word = lastPage[bit >> 6];
+        BOOL isNew = !(word & mask);
+        word |= mask;
+        numChunks += isNew;
+        return isNew;
+    }
 
-KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", 
-    "f","0", "FastForward Instructions");
+    UINT32 ChunkBits() const { return chunkBits; }
 
-/* ===================================================================== */
-// Utilities
-/* ===================================================================== */
+    // Number of chunks touched so far
+    UINT64 Chunks() const { return numChunks; }
+
+    /*!
+     * Add every chunk touched in another bitmap of the same chunk size.
+     */
+    VOID Merge(const CHUNK_BITMAP& other)
+    {
+        for (UINT64 r = 0; r < (1 << ROOT_BITS); r++)
+        {
+            if (!other.root[r]) continue;
+            for (UINT64 d = 0; d < (1 << DIR_BITS); d++)
+            {
+                LEAF leaf = other.root[r]->leaves[d];
+                if (!leaf) continue;
+                UINT64 firstPage = ((r << DIR_BITS) | d) << LEAF_BITS;
+                for (UINT64 p = 0; p < (1 << LEAF_BITS); p++)
+                {
+                    const UINT64* page = leaf + p * pageWords;
+                    if (!PageTouched(page)) continue;
+                    UINT64* mine = FindPage(firstPage + p);
+                    for (UINT32 w = 0; w < pageWords; w++) {
+                        numChunks += __builtin_popcountll(page[w] & ~mine[w]);
+                        mine[w] |= page[w];
+                    }
+                }
+            }
+        }
+        lastPageNum = ~0ULL;
+    }
+
+    /*!
+     * Number of distinct blocks of 2^granBits bytes touched so far.
+     * Pages are visited in address order: blocks smaller than a page are counted
+     * by folding each page mask, larger blocks by counting changes of block number
+     * between consecutive touched pages.
+     * @param[in]   granBits    log2 of the block size, at least ChunkBits()
+     */
+    UINT64 Count(UINT32 granBits) const
+    {
+        UINT64 total = 0;
+        UINT64 lastBlock = ~0ULL;
+        for (UINT64 r = 0; r < (1 << ROOT_BITS); r++)
+        {
+            if (!root[r]) continue;
+            for (UINT64 d = 0; d < (1 << DIR_BITS); d++)
+            {
+                LEAF leaf = root[r]->leaves[d];
+                if (!leaf) continue;
+                for (UINT64 p = 0; p < (1 << LEAF_BITS); p++)
+                {
+                    const UINT64* page = leaf + p * pageWords;
+                    if (granBits >= PAGE_BITS)
+                    {
+                        if (!PageTouched(page)) continue;
+                        UINT64 pageNum = (((r << DIR_BITS) | d) << LEAF_BITS) | p;
+                        UINT64 block = pageNum >> (granBits - PAGE_BITS);
+                        if (block != lastBlock) total++;
+                        lastBlock = block;
+                    }
+                    else
+                    {
+                        total += CountInPage(page, 1U << (granBits - chunkBits));
+                    }
+                }
+            }
+        }
+        return total;
+    }
+
+  private:
+    BOOL PageTouched(const UINT64* page) const
+    {
+        for (UINT32 w = 0; w < pageWords; w++)
+        {
+            if (page[w]) return TRUE;
+        }
+        return FALSE;
+    }
+
+    // Number of groups of chunksPerBlock adjacent chunks with at least one touched chunk
+    UINT64 CountInPage(const UINT64* page, UINT32 chunksPerBlock) const
+    {
+        UINT64 total = 0;
+        if (chunksPerBlock >= 64)
+        {
+            UINT32 wordsPerBlock = chunksPerBlock / 64;
+            for (UINT32 w = 0; w < pageWords; w += wordsPerBlock)
+            {
+                for (UINT32 i = 0; i < wordsPerBlock; i++)
+                {
+                    if (page[w + i]) { total++; break; }
+                }
+            }
+            return total;
+        }
+
+        // Bit 0 of every block
+        UINT64 firstBits = 0;
+        for (UINT32 b = 0; b < 64; b += chunksPerBlock) firstBits |= 1ULL << b;
+        for (UINT32 w = 0; w < pageWords; w++)
+        {
+            UINT64 folded = page[w];
+            for (UINT32 shift = 1; shift < chunksPerBlock; shift <<= 1) folded |= folded >> shift;
+            total += __builtin_popcountll(folded & firstBits);
+        }
+        return total;
+    }
+
+    // Walk the radix directory, allocating the missing levels
+    UINT64* FindPage(UINT64 pageNum)
+    {
+        UINT32 r = (pageNum >> (LEAF_BITS + DIR_BITS)) & ((1 << ROOT_BITS) - 1);
+        UINT32 d = (pageNum >> LEAF_BITS) & ((1 << DIR_BITS) - 1);
+        if (!root[r]) root[r] = new DIR();
+        LEAF& leaf = root[r]->leaves[d];
+        if (!leaf) leaf = new UINT64[(1 << LEAF_BITS) * pageWords]();
+        return leaf + (pageNum & ((1 << LEAF_BITS) - 1)) * pageWords;
+    }
+
+    const UINT32 chunkBits;
+    const UINT32 pageChunkBits;
+    const UINT32 pageWords;
+    DIR* root[1 << ROOT_BITS];
+    UINT64 numChunks;
+    UINT64 lastPageNum;   // page of the previous access, to skip the directory walk
+    UINT64* lastPage;
+};
 
 /*!
- *  Print out help message.
+ * HyperLogLog estimate of the number of distinct chunks touched, in 2^precision
+ * one-byte registers whatever the size of the address space. Each chunk number
+ * is hashed; the top precision bits select a register, which keeps the largest
+ * position of the first set bit seen in the remaining hash bits.
  */
-INT32 Usage()
+class CHUNK_SKETCH
 {
-    cerr << "This tool prints out the number of dynamically executed " << endl
-         << "instructions, basic blocks and threads in the application." << endl
-         << endl;
+  public:
+    /*!
+     * @param[in]   chunkBits   log2 of the chunk size
+     * @param[in]   precision   log2 of the number of registers, 4 to 18
+     */
+    CHUNK_SKETCH(UINT32 chunkBits, UINT32 precision)
+        : chunkBits(chunkBits), precision(precision), registers(1U << precision, 0)
+    {
+    }
 
-    cerr << KNOB_BASE::StringKnobSummary() << endl;
+    /*!
+     * Add every chunk touched by the access [addr, addr + size).
+     */
+    inline VOID Insert(ADDRINT addr, UINT32 size)
+    {
+        if (size == 0) return;
+        UINT64 last = ((UINT64)addr + size - 1) >> chunkBits;
+        for (UINT64 chunk = (UINT64)addr >> chunkBits; chunk <= last; chunk++)
+        {
+            UINT64 hash = Hash(chunk);
+            UINT8 rank = __builtin_clzll((hash << precision) | (1ULL << (precision - 1))) + 1;
+            UINT8& reg = registers[hash >> (64 - precision)];
+            if (rank > reg) reg = rank;
+        }
+    }
 
-    return -1;
-}
+    VOID Merge(const CHUNK_SKETCH& other)
+    {
+        for (size_t i = 0; i < registers.size(); i++)
+        {
+            registers[i] = std::max(registers[i], other.registers[i]);
+        }
+    }
 
-/* ===================================================================== */
-// Analysis routines
-/* ===================================================================== */
+    /*!
+     * Estimated number of distinct chunks, with linear counting for small
+     * cardinalities where the raw estimate is biased.
+     */
+    UINT64 Estimate() const
+    {
+        double m = registers.size();
+        double sum = 0;
+        UINT32 zeros = 0;
+        for (size_t i = 0; i < registers.size(); i++)
+        {
+            sum += 1.0 / (1ULL << registers[i]);
+            zeros += (registers[i] == 0);
+        }
+        double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+        return (UINT64)(estimate + 0.5);
+    }
+
+    // Relative standard error of Estimate()
+    double StandardError() const { return 1.04 / sqrt((double)registers.size()); }
+
+  private:
+    // SplitMix64 finalizer: consecutive chunk numbers must not share register bits
+    static UINT64 Hash(UINT64 x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    const UINT32 chunkBits;
+    const UINT32 precision;
+    std::vector<UINT8> registers;
+};
 
 /*!
- * Increase counter of the executed basic blocks and instructions.
- * This function is called for every basic block when it is about to be executed.
- * @param[in]   numInstInBbl    number of instructions in the basic block
- * @note use atomic operations for multi-threaded applications
+ * LRU stack distance of every access to a stream of blocks: the number of
+ * distinct other blocks accessed since the previous access to the same block.
+ * A fully associative LRU cache of C blocks misses exactly on the accesses with
+ * a distance of at least C and on the first access to each block.
+ * Each block's most recent access is marked at its timestamp in a Fenwick tree,
+ * so the distance is the number of marks after the block's previous timestamp.
+ * Timestamps are renumbered densely whenever the tree fills up.
  */
-VOID CountBbl(UINT32 numInstInBbl)
+class REUSE_DISTANCE
 {
-    bblCount++;
-    insCount += numInstInBbl;
-}
+  public:
+    static const UINT32 NUM_BUCKETS = 40;   // log2 buckets: 0, [1,2), [2,4), ...
+
+    /*!
+     * @param[in]   blockBits   log2 of the block size
+     */
+    explicit REUSE_DISTANCE(UINT32 blockBits)
+        : blockBits(blockBits), now(0), tree(INITIAL_STAMPS + 1, 0), coldMisses(0)
+    {
+    }
+
+    /*!
+     * Access every block touched by [addr, addr + size).
+     */
+    VOID Access(ADDRINT addr, UINT32 size)
+    {
+        if (size == 0) return;
+        UINT64 last = ((UINT64)addr + size - 1) >> blockBits;
+        for (UINT64 block = (UINT64)addr >> blockBits; block <= last; block++)
+        {
+            Touch(block);
+        }
+    }
+
+    VOID Merge(const REUSE_DISTANCE& other)
+    {
+        distances.Merge(other.distances);
+        coldMisses += other.coldMisses;
+    }
+
+    UINT32 BlockBits() const { return blockBits; }
+
+    // Accesses by log2 bucket of their distance, see Bucket()
+    const HISTOGRAM<NUM_BUCKETS>& Distances() const { return distances; }
+
+    // First accesses to a block, which have an infinite distance
+    UINT64 ColdMisses() const { return coldMisses; }
+
+    // Bucket 0 holds distance 0 and bucket b > 0 the distances in [2^(b-1), 2^b)
+    static UINT32 Bucket(UINT64 distance) { return distance ? 64 - __builtin_clzll(distance) : 0; }
+
+  private:
+    static const UINT64 INITIAL_STAMPS = 1 << 20;
+
+    VOID Touch(UINT64 block)
+    {
+        if (now + 1 >= tree.size()) Renumber();
+
+        std::unordered_map<UINT64, UINT64>::iterator it = lastAccess.find(block);
+        if (it == lastAccess.end())
+        {
+            coldMisses++;
+            it = lastAccess.insert(std::make_pair(block, 0)).first;
+        }
+        else
+        {
+            distances.Add(Bucket(Prefix(now) - Prefix(it->second)));
+            Update(it->second, -1);
+        }
+        it->second = ++now;
+        Update(now, 1);
+    }
+
+    // Number of marks at timestamps 1..stamp
+    UINT64 Prefix(UINT64 stamp) const
+    {
+        UINT64 sum = 0;
+        for (; stamp; stamp &= stamp - 1) sum += tree[stamp];
+        return sum;
+    }
+
+    VOID Update(UINT64 stamp, INT32 delta)
+    {
+        for (; stamp < tree.size(); stamp += stamp & (~stamp + 1)) tree[stamp] += delta;
+    }
+
+    /*!
+     * Give the blocks the timestamps 1..n in the order of their last access and
+     * rebuild the tree, doubling it if it would be more than half full.
+     */
+    VOID Renumber()
+    {
+        std::vector<UINT64*> stamps;
+        stamps.reserve(lastAccess.size());
+        for (std::unordered_map<UINT64, UINT64>::iterator it = lastAccess.begin(); it != lastAccess.end(); ++it)
+        {
+            stamps.push_back(&it->second);
+        }
+        std::sort(stamps.begin(), stamps.end(), StampOrder);
+        for (size_t i = 0; i < stamps.size(); i++) *stamps[i] = i + 1;
+        now = stamps.size();
+
+        UINT64 size = tree.size() - 1;
+        while (now * 2 > size) size *= 2;
+        tree.assign(size + 1, 0);
+        for (UINT64 stamp = 1; stamp <= size; stamp++)
+        {
+            if (stamp <= now) tree[stamp]++;
+            UINT64 parent = stamp + (stamp & (~stamp + 1));
+            if (parent <= size) tree[parent] += tree[stamp];
+        }
+    }
+
+    static bool StampOrder(const UINT64* a, const UINT64* b) { return *a < *b; }
+
+    const UINT32 blockBits;
+    UINT64 now;                                       // latest timestamp handed out
+    std::vector<INT32> tree;                          // Fenwick tree over timestamps 1..size-1
+    std::unordered_map<UINT64, UINT64> lastAccess;    // timestamp of each block's latest access
+    HISTOGRAM<NUM_BUCKETS> distances;
+    UINT64 coldMisses;
+};
+
+/*!
+ * Distinct 4 KB pages and 64 B lines touched in the current window of a
+ * tumbling-window working set measurement. Every page and line entry is tagged
+ * with the last window that touched it, so starting a window only changes the
+ * current tag instead of clearing the tables.
+ */
+class WORKING_SET
+{
+  public:
+    static const UINT32 PAGE_BITS = 12;
+    static const UINT32 LINE_BITS = 6;
+
+    WORKING_SET() : window(0), pages(0), lines(0) {}
+
+    VOID Access(ADDRINT addr, UINT32 size)
+    {
+        if (size == 0) return;
+        UINT64 last = (UINT64)addr + size - 1;
+        Touch(pageWindows, (UINT64)addr >> PAGE_BITS, last >> PAGE_BITS, pages);
+        Touch(lineWindows, (UINT64)addr >> LINE_BITS, last >> LINE_BITS, lines);
+    }
+
+    VOID StartWindow(UINT32 next)
+    {
+        window = next;
+        pages = 0;
+        lines = 0;
+    }
+
+    UINT32 Window() const { return window; }
+    UINT64 Pages() const { return pages; }
+    UINT64 Lines() const { return lines; }
+
+  private:
+    // Tags are window + 1, so that a new entry (tag 0) never matches
+    VOID Touch(std::unordered_map<UINT64, UINT32>& windows, UINT64 first, UINT64 last, UINT64& count)
+    {
+        for (UINT64 block = first; block <= last; block++)
+        {
+            UINT32& tag = windows[block];
+            if (tag != window + 1)
+            {
+                tag = window + 1;
+                count++;
+            }
+        }
+    }
+
+    UINT32 window;
+    UINT64 pages;
+    UINT64 lines;
+    std::unordered_map<UINT64, UINT32> pageWindows;
+    std::unordered_map<UINT64, UINT32> lineWindows;
+};
+
+// Access patterns of the loads of one PC
+enum LOAD_PATTERN
+{
+    PATTERN_STRIDE = 0,   // same non-zero stride as the previous load, covered by a stride prefetcher
+    PATTERN_SAME,         // same address as the previous load
+    PATTERN_CHASE,        // address produced by a load
+    PATTERN_IRREGULAR,
+    NUM_LOAD_PATTERNS
+};
+
+static const char* const loadPatternNames[NUM_LOAD_PATTERNS] = {
+    "Constant stride", "Same address", "Pointer chasing", "Irregular"
+};
+
+/*!
+ * Stride table entry of one load PC and the patterns of its dynamic loads.
+ */
+struct STRIDE_ENTRY
+{
+    ADDRINT lastAddr;
+    ADDRDELTA stride;     // difference between the last two addresses
+    UINT64 counts[NUM_LOAD_PATTERNS];
+};
+
+/*!
+ * Per-PC stride table classifying every dynamic load. A load continuing the
+ * stride of the previous load of its PC is one a reference prediction table
+ * prefetcher would have fetched ahead of time. Loads that break the stride are
+ * pointer chasing if their address registers were produced by a load (decided
+ * at instrumentation time, see IsPointerChase()) and irregular otherwise.
+ */
+class LOAD_PATTERNS
+{
+  public:
+    inline VOID Access(ADDRINT pc, ADDRINT ea, BOOL chase)
+    {
+        std::pair<std::unordered_map<ADDRINT, STRIDE_ENTRY>::iterator, BOOL> found =
+            table.insert(std::make_pair(pc, STRIDE_ENTRY()));
+        STRIDE_ENTRY& entry = found.first->second;
+        ADDRDELTA stride = (ADDRDELTA)(ea - entry.lastAddr);
+        LOAD_PATTERN pattern;
+        if (found.second) pattern = chase ? PATTERN_CHASE : PATTERN_IRREGULAR;
+        else if (stride == 0) pattern = PATTERN_SAME;
+        else if (stride == entry.stride) pattern = PATTERN_STRIDE;
+        else pattern = chase ? PATTERN_CHASE : PATTERN_IRREGULAR;
+        entry.counts[pattern]++;
+        entry.stride = found.second ? 0 : stride;
+        entry.lastAddr = ea;
+    }
+
+    // Add the pattern counts of another table; strides are kept from this one
+    VOID Merge(const LOAD_PATTERNS& other)
+    {
+        for (std::unordered_map<ADDRINT, STRIDE_ENTRY>::const_iterator it = other.table.begin();
+             it != other.table.end(); ++it)
+        {
+            std::pair<std::unordered_map<ADDRINT, STRIDE_ENTRY>::iterator, BOOL> found = table.insert(*it);
+            if (found.second) continue;
+            for (UINT32 p = 0; p < NUM_LOAD_PATTERNS; p++) found.first->second.counts[p] += it->second.counts[p];
+        }
+    }
+
+    const std::unordered_map<ADDRINT, STRIDE_ENTRY>& Table() const { return table; }
+
+  private:
+    std::unordered_map<ADDRINT, STRIDE_ENTRY> table;
+};
+
+static const UINT32 DATAFLOW_MEM_OPERANDS = 2;   // memory operands followed per instruction
+
+/*!
+ * Static dataflow description of one instruction: the registers it reads and
+ * writes, the Part B latency of its operation and its first memory operands.
+ */
+struct DATAFLOW_INS
+{
+    std::vector<REG> reads;
+    std::vector<REG> writes;
+    BOOL readsMemory;         // the registers it writes hold load-produced values
+    UINT32 latency;
+    UINT32 numMemOps;
+    UINT32 memSize[DATAFLOW_MEM_OPERANDS];
+    BOOL memRead[DATAFLOW_MEM_OPERANDS];
+    BOOL memWritten[DATAFLOW_MEM_OPERANDS];
+};
+
+/*!
+ * Dataflow limit of one thread's instruction stream on a machine with perfect
+ * branch prediction, unlimited functional units and the Part B latencies.
+ * Every register and every 4-byte memory chunk (one load/store micro-op) holds
+ * the cycle its value becomes ready. An instruction issues once its source
+ * registers are ready, its loads complete MEM_OP_LATENCY cycles after both their
+ * address and the chunk are ready, its operation takes the latency of its
+ * category and its stores make their chunks ready MEM_OP_LATENCY cycles later.
+ * With a window of W instructions an instruction also waits until the one W
+ * instructions earlier has retired, retirement being in order.
+ */
+class DATAFLOW
+{
+  public:
+    /*!
+     * @param[in]   window      instruction window size, 0 for an unbounded machine
+     */
+    explicit DATAFLOW(UINT32 window)
+        : window(window), retired(window, 0), next(0), lastRetire(0), criticalPath(0), instructions(0)
+    {
+        std::fill(regReady, regReady + REG_LAST, 0);
+    }
+
+    VOID Execute(const DATAFLOW_INS* ins, const ADDRINT* ea)
+    {
+        UINT64 issue = window ? retired[next] : 0;
+        for (size_t r = 0; r < ins->reads.size(); r++) {
+            issue = std::max(issue, regReady[ins->reads[r]]);
+        }
+
+        UINT64 start = issue;
+        for (UINT32 m = 0; m < ins->numMemOps; m++) {
+            if (!ins->memRead[m]) continue;
+            for (UINT64 chunk = ea[m] >> 2; chunk <= (ea[m] + ins->memSize[m] - 1) >> 2; chunk++) {
+                std::unordered_map<UINT64, UINT64>::const_iterator it = memReady.find(chunk);
+                UINT64 ready = (it == memReady.end()) ? issue : std::max(issue, it->second);
+                start = std::max(start, ready + MEM_OP_LATENCY);
+            }
+        }
+
+        UINT64 done = start + ins->latency;
+        for (size_t r = 0; r < ins->writes.size(); r++) {
+            regReady[ins->writes[r]] = done;
+        }
+        UINT64 complete = done;
+        for (UINT32 m = 0; m < ins->numMemOps; m++) {
+            if (!ins->memWritten[m]) continue;
+            for (UINT64 chunk = ea[m] >> 2; chunk <= (ea[m] + ins->memSize[m] - 1) >> 2; chunk++) {
+                memReady[chunk] = done + MEM_OP_LATENCY;
+            }
+            complete = done + MEM_OP_LATENCY;
+        }
+
+        if (window) {
+            lastRetire = std::max(lastRetire, complete);
+            retired[next] = lastRetire;
+            next = (next + 1 == window) ? 0 : next + 1;
+        }
+        criticalPath = std::max(criticalPath, complete);
+        instructions++;
+    }
 
-// Analysis routine to track number of instructions executed, and check the exit condition
-VOID InsCount()	{
-	icount++;
+    UINT32 Window() const { return window; }
+    UINT64 CriticalPath() const { return criticalPath; }
+    UINT64 Instructions() const { return instructions; }
+
+  private:
+    UINT32 window;
+    std::vector<UINT64> retired;    // retire cycles of the last window instructions, a ring
+    UINT32 next;                    // oldest entry of retired
+    UINT64 lastRetire;
+    UINT64 criticalPath;            // completion cycle of the last instruction to complete
+    UINT64 instructions;
+    UINT64 regReady[REG_LAST];
+    std::unordered_map<UINT64, UINT64> memReady;
+};
+
+/*!
+ * Register dependence distances of one thread: for every register read, the
+ * number of dynamic instructions since the producer of its value executed.
+ * The last writer of every register is kept as (instruction number << 1) with
+ * the low bit set when the writer read memory, so that distances to
+ * load-produced values are also collected separately. Reads of values produced
+ * before the measured window have no producer.
+ */
+class DEPENDENCE_DISTANCES
+{
+  public:
+    DEPENDENCE_DISTANCES() : now(0), noProducer(0)
+    {
+        std::fill(lastWriter, lastWriter + REG_LAST, 0);
+    }
+
+    inline VOID Execute(const DATAFLOW_INS* ins)
+    {
+        now++;
+        for (size_t r = 0; r < ins->reads.size(); r++) {
+            UINT64 writer = lastWriter[ins->reads[r]];
+            if (!writer) {
+                noProducer++;
+                continue;
+            }
+            UINT32 bucket = REUSE_DISTANCE::Bucket(now - (writer >> 1));
+            all.Add(bucket);
+            if (writer & 1) loaded.Add(bucket);
+        }
+        UINT64 writer = (now << 1) | (ins->readsMemory ? 1 : 0);
+        for (size_t r = 0; r < ins->writes.size(); r++) {
+            lastWriter[ins->writes[r]] = writer;
+        }
+    }
+
+    VOID Merge(const DEPENDENCE_DISTANCES& other)
+    {
+        all.Merge(other.all);
+        loaded.Merge(other.loaded);
+        noProducer += other.noProducer;
+    }
+
+    // Reads by log2 bucket of their distance, see REUSE_DISTANCE::Bucket()
+    const HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS>& All() const { return all; }
+    const HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS>& Loaded() const { return loaded; }
+    UINT64 NoProducer() const { return noProducer; }
+
+  private:
+    UINT64 now;                     // instructions executed by the thread
+    UINT64 noProducer;
+    HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS> all;
+    HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS> loaded;
+    UINT64 lastWriter[REG_LAST];
+};
+
+static const UINT64 INVALID_TAG = ~0ULL;
+
+/*!
+ * Set-associative cache with LRU replacement and write-allocate, used by the
+ * optional data cache model. The ways of a set are kept in recency order, most
+ * recently used first.
+ */
+class CACHE
+{
+  public:
+    /*!
+     * @param[in]   size        capacity in bytes
+     * @param[in]   assoc       number of ways
+     * @param[in]   lineBits    log2 of the line size
+     * @param[in]   latency     cycles charged to an access that hits in this level
+     */
+    CACHE(UINT64 size, UINT32 assoc, UINT32 lineBits, UINT32 latency)
+        : assoc(assoc),
+          lineBits(lineBits),
+          numSets(size >> lineBits),
+          latency(latency),
+          hits(0),
+          misses(0)
+    {
+        numSets /= assoc;
+        tags.assign(numSets * assoc, INVALID_TAG);
+    }
+
+    /*!
+     * Look up the line holding addr and make it the most recently used line of its
+     * set, filling it on a miss.
+     * @return TRUE on a hit
+     */
+    BOOL Access(ADDRINT addr)
+    {
+        UINT64 line = (UINT64)addr >> lineBits;
+        UINT64* set = &tags[(line & (numSets - 1)) * assoc];
+        UINT32 way = 0;
+        while (way < assoc && set[way] != line) way++;
+        BOOL hit = (way < assoc);
+        if (hit) hits++; else { misses++; way = assoc - 1; }
+        for (; way > 0; way--) set[way] = set[way - 1];
+        set[0] = line;
+        return hit;
+    }
+
+    UINT32 Latency() const { return latency; }
+    UINT64 Hits() const { return hits; }
+    UINT64 Misses() const { return misses; }
+
+  private:
+    UINT32 assoc;
+    UINT32 lineBits;
+    UINT64 numSets;
+    UINT32 latency;
+    UINT64 hits;
+    UINT64 misses;
+    std::vector<UINT64> tags;
+};
+
+// Footprint granularity required by the assignment
+static const UINT32 FOOTPRINT_BITS = 5;
+
+// Unique chunks touched by instructions and data for footprint measurement,
+// merged from the per-thread bitmaps at exit
+static CHUNK_BITMAP* insChunks = NULL;
+static CHUNK_BITMAP* dataChunks = NULL;
+
+// HyperLogLog footprint estimates at FOOTPRINT_BITS, merged from the threads.
+// With -hll alone they replace the bitmaps; with -hllcheck both are kept.
+static UINT32 sketchPrecision = 0;             // 0 when disabled
+static BOOL exactFootprint = TRUE;
+static CHUNK_SKETCH* insSketch = NULL;
+static CHUNK_SKETCH* dataSketch = NULL;
+static UINT32 footprintChunkBits = FOOTPRINT_BITS;
+
+// log2 of the footprint granularities to report, from -fpgran
+static std::vector<UINT32> footprintGranBits;
+
+// Reuse distance block sizes and the histograms merged from all threads
+static std::vector<UINT32> reuseBlockBits;
+static std::vector<REUSE_DISTANCE*> reuseDists;
+
+// Instruction windows of the dataflow limit study, 0 for the unbounded machine
+static std::vector<UINT32> ilpWindows;
+
+// Load access patterns merged from all threads
+static BOOL strideAnalysis = FALSE;
+static LOAD_PATTERNS* loadPatterns = NULL;
+
+// Register dependence distances merged from all threads
+static BOOL dependenceAnalysis = FALSE;
+static DEPENDENCE_DISTANCES* dependences = NULL;
+
+static const UINT32 CACHE_LINE = 64;
+static const UINT32 EXEC_PAGE_BITS = 12;    // execution counters per page
+static const UINT32 MAX_EXEC_PAGES = 4096;  // up to 16M COUNT_DELTAs
+static const UINT32 INTERVAL_BUFFER_RECORDS = 1024;
+
+class TRACE_WRITER;
+
+/*!
+ * Counters of one application thread. Analysis routines reach the block of the
+ * running thread through a Pin tool register, so threads never share a cache
+ * line; the blocks are merged when the results are printed.
+ * The execution counters of the COUNT_DELTAs are kept in pages. A page is
+ * allocated for every thread as soon as the first delta indexing into it is
+ * created, so analysis routines never find a missing page.
+ */
+struct THREAD_DATA
+{
+    THREAD_DATA(THREADID tid, UINT32 chunkBits)
+        : tid(tid), cycles(0), memCycles(0), l1d(NULL), l2(NULL), itlb(NULL), dtlb(NULL), stlb(NULL), tlbCycles(0), insChunks(chunkBits), dataChunks(chunkBits),
+          insSketch(NULL), dataSketch(NULL),
+          bbvIns(0), bbvOut(NULL), intervalIns(0), numIntervals(0), intervalBuf(NULL),
+          wsIns(0), wsWindow(0), workingSet(NULL), loadPatterns(NULL), dependences(NULL), trace(NULL), traceStarted(FALSE),
+          roiDepth(0), roiEntries(0), sampleIns(0), sampleStats(), ins(0), bbls(0), unpublishedIns(0)
+    {
+        std::fill(counts, counts + NUM_INS_TYPES, 0);
+        std::fill(execPages, execPages + MAX_EXEC_PAGES, (UINT64*)NULL);
+    }
+
+    THREADID tid;
+    UINT64 counts[NUM_INS_TYPES];
+    UINT64 cycles;
+    UINT64* execPages[MAX_EXEC_PAGES];
+    UINT64 memCycles;          // load/store cycles charged by the cache model
+    CACHE* l1d;                // private levels of the cache model, NULL when disabled
+    CACHE* l2;
+    CACHE* itlb;               // TLBs of the TLB model, NULL when disabled
+    CACHE* dtlb;
+    CACHE* stlb;               // second level, shared by instructions and data
+    UINT64 tlbCycles;          // translation cycles charged by the TLB model
+    CHUNK_BITMAP insChunks;
+    CHUNK_BITMAP dataChunks;
+    CHUNK_SKETCH* insSketch;   // footprint estimates, NULL unless -hll is given
+    CHUNK_SKETCH* dataSketch;
+    std::vector<UINT64> bbv;   // instructions executed per basic block id in the current BBV interval
+    UINT64 bbvIns;             // instructions executed in the current BBV interval
+    std::ofstream* bbvOut;     // basic block vector file of the thread, NULL unless -bbv is given
+    UINT64 intervalIns;        // instructions executed in the current -interval interval
+    UINT32 numIntervals;       // intervals recorded so far
+    INTERVAL_RECORD intervalStart;      // counter values at the start of the current interval
+    INTERVAL_RECORD* intervalBuf;       // records not yet written, INTERVAL_BUFFER_RECORDS entries
+    std::vector<REUSE_DISTANCE*> reuse; // one per -reuse block size
+    UINT64 wsIns;              // instructions executed in the current working set window
+    UINT32 wsWindow;           // number of the current working set window, also held in epochReg
+    WORKING_SET* workingSet;   // NULL unless -ws is given
+    LOAD_PATTERNS* loadPatterns;        // NULL unless -stride is given
+    std::vector<DATAFLOW*> dataflow;    // one per -ilp window
+    DEPENDENCE_DISTANCES* dependences;  // NULL unless -depdist is given
+    TRACE_WRITER* trace;       // NULL unless -trace is given
+    BOOL traceStarted;         // PHASE_GUARDED: a block record of the thread has been written
+    UINT32 roiDepth;           // nesting depth of the region of interest, 0 outside it
+    UINT64 roiEntries;
+    UINT64 sampleIns;          // instructions since the current sample or gap started
+    UINT64 sampleStart[NUM_INS_TYPES + 1];   // counts and cycles at the start of the sample
+    SAMPLE_STATS sampleStats;
+    UINT64 ins;                // instructions executed by the thread
+    UINT64 bbls;               // basic blocks executed by the thread
+    UINT64 unpublishedIns;     // instructions not yet added to icount
+};
+
+static REG tlsReg;                             // holds the THREAD_DATA* of the running thread
+static TLS_KEY tlsKey;                         // THREAD_DATA* of a thread, for callbacks
+static std::vector<THREAD_DATA*> threadData;   // all threads seen so far
+static UINT32 numCountDeltas = 0;
+static PIN_LOCK threadLock;
+static UINT32 windowDone = 0;                  // set by the thread that reaches the window end
+static UINT64 roiEntries = 0;                  // region of interest entries summed over threads
+
+// SSC marks delimiting a region of interest: "mov ebx, <tag>" followed by the
+// "addr32 fs nop" used as a marker by Intel SDE and the __SSC_MARK() macro
+static const UINT8 SSC_MARK_BYTES[] = { 0x64, 0x67, 0x90 };
+static const UINT32 ROI_START_MARK = 0x111;
+static const UINT32 ROI_STOP_MARK = 0x222;
+
+// Trace versions of PHASE_SAMPLED
+static const ADDRINT VERSION_FAST = 0;         // between samples, the default version
+static const ADDRINT VERSION_DETAILED = 1;     // inside a sample
+static REG versionReg;                         // version each thread should run
+static UINT64 sampleGap = 0;                   // instructions between samples
+static UINT64 sampleLength = 0;                // instructions per sample
+
+// Cache model: private L1D and L2 per thread, LLC shared by all threads
+static BOOL cacheModel = FALSE;
+static CACHE* llc = NULL;
+static PIN_LOCK llcLock;
+static UINT64 l1dHits = 0, l1dMisses = 0;     // private level statistics summed over threads
+static UINT64 l2Hits = 0, l2Misses = 0;
+static UINT32 memLatency = 0;
+
+// TLB model: private L1 ITLB, L1 DTLB and L2 STLB per thread, all for one page
+// size. They are CACHEs whose lines are pages.
+static BOOL tlbModel = FALSE;
+static UINT32 pageBits = 0;
+static UINT32 walkLatency = 0;                 // cycles of a page walk after an STLB miss
+static UINT64 itlbMisses = 0, dtlbMisses = 0, stlbMisses = 0;    // summed over threads
+static UINT64 itlbAccesses = 0, dtlbAccesses = 0, stlbAccesses = 0;
+static UINT64 tlb_cycles = 0;
+
+/*!
+ * One data access of the measured window, recorded by the JIT'd code into the
+ * per-thread trace buffer and processed in batches by MemBufferFull(). When a
+ * trace file is recorded, block executions and executions of predicated
+ * instructions without data access are buffered as MEM_REFs as well.
+ */
+struct MEM_REF
+{
+    ADDRINT pc;       // address of the accessing instruction
+    ADDRINT ea;       // effective address
+    UINT32 size;      // bytes accessed
+    UINT32 flags;     // MEM_REF_WRITE, MEM_REF_CHASE, MEM_REF_EXEC or MEM_REF_BLOCK
+    UINT32 window;    // working set window of the access, only recorded with -ws
+};
+
+static const UINT32 MEM_REF_WRITE = 1;         // a store
+static const UINT32 MEM_REF_CHASE = 2;         // a load whose address registers were produced by a load
+static const UINT32 MEM_REF_EXEC = 4;          // execution of a predicated instruction without data access
+static const UINT32 MEM_REF_BLOCK = 8;         // execution of the block at pc with dictionary id ea
+static_assert(MEM_REF_WRITE == TRACE_WRITE && MEM_REF_CHASE == TRACE_CHASE && MEM_REF_EXEC == TRACE_EXEC,
+              "MEM_REF flags are written to the trace");
+
+static const UINT32 MEM_BUFFER_PAGES = 256;
+static BUFFER_ID memBuffer;
+
+// Trace file recording: chunks are appended by the threads as they fill up, the
+// block dictionary and the chunk index are written at exit
+static const UINT32 TRACE_CHUNK_BYTES = 1 << 20;
+static std::ofstream* traceOut = NULL;
+static PIN_LOCK traceLock;
+static std::vector<TRACE_INDEX_ENTRY> traceIndex;
+static std::vector<TRACE_BLOCK> traceBlocks;
+static std::vector<TRACE_INS> traceIns;
+
+/*!
+ * Encoder of one thread's trace records, see TRACE_FILE_HEADER for the format.
+ * Records are collected into a chunk that is written out once it reaches
+ * TRACE_CHUNK_BYTES, at the next block record so that every chunk starts with one.
+ * The data accesses of the last appended batch are kept for the other analyses.
+ */
+class TRACE_WRITER
+{
+  public:
+    explicit TRACE_WRITER(THREADID tid) : tid(tid), blocks(0), blockAddr(0), lastEa(0)
+    {
+        chunk.reserve(TRACE_CHUNK_BYTES + 3 * MAX_VARINT_BYTES);
+    }
+
+    VOID Append(const MEM_REF* refs, UINT64 numRefs)
+    {
+        accesses.clear();
+        for (UINT64 i = 0; i < numRefs; i++) {
+            UINT8 record[3 * MAX_VARINT_BYTES];
+            UINT8* end = record;
+            if (refs[i].flags & MEM_REF_BLOCK) {
+                if (chunk.size() >= TRACE_CHUNK_BYTES) Flush();
+                end = PutVarint(end, (UINT64)refs[i].ea << 1);
+                blockAddr = refs[i].pc;
+                blocks++;
+            } else if (refs[i].flags & MEM_REF_EXEC) {
+                end = PutVarint(end, (MEM_REF_EXEC << 1) | 1);
+                end = PutVarint(end, refs[i].pc - blockAddr);
+            } else {
+                end = PutVarint(end, ((UINT64)refs[i].size << 4) | ((refs[i].flags & 7) << 1) | 1);
+                end = PutVarint(end, refs[i].pc - blockAddr);
+                end = PutVarint(end, ZigZag((INT64)(refs[i].ea - lastEa)));
+                lastEa = refs[i].ea;
+                accesses.push_back(refs[i]);
+            }
+            chunk.insert(chunk.end(), record, end);
+        }
+    }
+
+    // Write out the current chunk, if any, and start a new one
+    VOID Flush()
+    {
+        if (chunk.empty()) return;
+        TRACE_INDEX_ENTRY entry;
+        entry.chunk.tid = tid;
+        entry.chunk.bytes = chunk.size();
+        entry.chunk.blocks = blocks;
+
+        PIN_GetLock(&traceLock, tid + 1);
+        entry.offset = traceOut->tellp();
+        traceOut->write(reinterpret_cast<const char*>(&entry.chunk), sizeof(entry.chunk));
+        traceOut->write(reinterpret_cast<const char*>(&chunk[0]), chunk.size());
+        traceIndex.push_back(entry);
+        PIN_ReleaseLock(&traceLock);
+
+        chunk.clear();
+        blocks = 0;
+        lastEa = 0;
+    }
+
+    const std::vector<MEM_REF>& Accesses() const { return accesses; }
+
+  private:
+    THREADID tid;
+    std::vector<UINT8> chunk;
+    std::vector<MEM_REF> accesses;     // data accesses of the last appended batch
+    UINT64 blocks;             // block records in the chunk
+    ADDRINT blockAddr;         // address of the current block
+    ADDRINT lastEa;
+};
+
+// Basic block vector collection: block ids are keyed by block address so that
+// re-instrumented code keeps its id
+static UINT64 bbvInterval = 0;                 // instructions per interval, 0 when disabled
+static std::map<ADDRINT, UINT32> bbvBlockIds;
+
+// Working set over time: each thread's window number is kept in a tool register
+// so that it is recorded with every memory access
+static UINT64 wsLength = 0;                    // instructions per window, 0 when disabled
+static REG epochReg;
+static std::ofstream* wsOut = NULL;
+static PIN_LOCK wsLock;
+
+// Interval time series of the measured window
+static UINT64 intervalLength = 0;              // instructions per interval, 0 when disabled
+static std::ofstream* intervalOut = NULL;
+static PIN_LOCK intervalLock;
+
+/* ===================================================================== */
+// Command line switches
+/* ===================================================================== */
+KNOB< string > KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "", "specify file name for MyPinTool output");
+
+KNOB< BOOL > KnobCount(KNOB_MODE_WRITEONCE, "pintool", "count", "1",
+                       "count instructions, basic blocks and threads in the application");
+
+KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", 
+    "f","0", "FastForward Instructions");
+
+KNOB<BOOL> KnobTwoPhase(KNOB_MODE_WRITEONCE, "pintool", "twophase", "1",
+    "fast-forward with an icount-only instrumentation and drop the FastForward guards in the window");
+
+KNOB<string> KnobFootprintGranularity(KNOB_MODE_WRITEONCE, "pintool", "fpgran", "32,64,4096,2097152",
+    "comma-separated power-of-two footprint granularities in bytes");
+
+KNOB<string> KnobReuse(KNOB_MODE_WRITEONCE, "pintool", "reuse", "",
+    "comma-separated block sizes in bytes of the data reuse distance histograms, e.g. 32,64");
+
+KNOB<UINT32> KnobTopK(KNOB_MODE_WRITEONCE, "pintool", "topk", "0",
+    "report the <n> basic blocks with the most cycles and the <n> most executed loads, 0 to disable");
+
+KNOB<BOOL> KnobDependences(KNOB_MODE_WRITEONCE, "pintool", "depdist", "0",
+    "report how many instructions ago the producer of every register read executed, also for load-produced values only");
+
+KNOB<BOOL> KnobIclass(KNOB_MODE_WRITEONCE, "pintool", "iclass", "0",
+    "report the executions of every XED iclass and ISA extension, most frequent first");
+
+KNOB<UINT32> KnobSketch(KNOB_MODE_WRITEONCE, "pintool", "hll", "0",
+    "estimate the 32-byte footprint with a HyperLogLog sketch of 2^<n> registers (4-18) instead of the bitmaps, 0 to disable");
+KNOB<BOOL> KnobSketchCheck(KNOB_MODE_WRITEONCE, "pintool", "hllcheck", "0",
+    "with -hll, keep the exact bitmaps as well and report the error of the estimates");
+
+KNOB<UINT64> KnobWorkingSet(KNOB_MODE_WRITEONCE, "pintool", "ws", "0",
+    "measure the data working set of every <n> million instructions of the window, 0 to disable");
+KNOB<string> KnobWorkingSetFile(KNOB_MODE_WRITEONCE, "pintool", "wsfile", "HW1.ws",
+    "working set series file");
+
+KNOB<BOOL> KnobStride(KNOB_MODE_WRITEONCE, "pintool", "stride", "0",
+    "classify the access pattern of every load PC and report the stride prefetcher coverage");
+
+KNOB<BOOL> KnobIlp(KNOB_MODE_WRITEONCE, "pintool", "ilp", "0",
+    "report the dataflow critical path CPI of an unbounded machine and of the -ilpwin windows");
+KNOB<string> KnobIlpWindows(KNOB_MODE_WRITEONCE, "pintool", "ilpwin", "64,128,256",
+    "comma-separated instruction window sizes of the dataflow limit study");
+
+KNOB<string> KnobTraceFile(KNOB_MODE_WRITEONCE, "pintool", "trace", "",
+    "also record the executed blocks and data accesses of the window to a trace file for offline replay");
+
+KNOB<string> KnobRoiRoutine(KNOB_MODE_WRITEONCE, "pintool", "roi", "",
+    "measure only while the named routine is active, instead of the -f window");
+KNOB<BOOL> KnobRoiMarkers(KNOB_MODE_WRITEONCE, "pintool", "roimark", "0",
+    "measure only between SSC start (0x111) and stop (0x222) markers, instead of the -f window");
+
+KNOB<UINT64> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool", "sample", "0",
+    "sample the whole run with one detailed sample every <n> instructions instead of the -f window, 0 to disable");
+KNOB<UINT64> KnobSampleLength(KNOB_MODE_WRITEONCE, "pintool", "samplelen", "10000",
+    "instructions per detailed sample");
+
+KNOB<BOOL> KnobCacheModel(KNOB_MODE_WRITEONCE, "pintool", "cache", "0",
+    "charge loads and stores by an L1D/L2/LLC cache model instead of a flat latency");
+KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool", "line", "64", "cache line size in bytes");
+KNOB<UINT64> KnobL1Size(KNOB_MODE_WRITEONCE, "pintool", "l1size", "32768", "L1D size in bytes");
+KNOB<UINT32> KnobL1Assoc(KNOB_MODE_WRITEONCE, "pintool", "l1assoc", "8", "L1D associativity");
+KNOB<UINT32> KnobL1Latency(KNOB_MODE_WRITEONCE, "pintool", "l1lat", "4", "L1D hit latency in cycles");
+KNOB<UINT64> KnobL2Size(KNOB_MODE_WRITEONCE, "pintool", "l2size", "262144", "L2 size in bytes");
+KNOB<UINT32> KnobL2Assoc(KNOB_MODE_WRITEONCE, "pintool", "l2assoc", "8", "L2 associativity");
+KNOB<UINT32> KnobL2Latency(KNOB_MODE_WRITEONCE, "pintool", "l2lat", "12", "L2 hit latency in cycles");
+KNOB<UINT64> KnobLlcSize(KNOB_MODE_WRITEONCE, "pintool", "llcsize", "8388608", "LLC size in bytes");
+KNOB<UINT32> KnobLlcAssoc(KNOB_MODE_WRITEONCE, "pintool", "llcassoc", "16", "LLC associativity");
+KNOB<UINT32> KnobLlcLatency(KNOB_MODE_WRITEONCE, "pintool", "llclat", "40", "LLC hit latency in cycles");
+KNOB<UINT32> KnobMemLatency(KNOB_MODE_WRITEONCE, "pintool", "memlat", "200", "memory latency in cycles");
+
+KNOB<BOOL> KnobTlbModel(KNOB_MODE_WRITEONCE, "pintool", "tlb", "0",
+    "translate instruction and data addresses through an L1 ITLB/L1 DTLB/L2 STLB model and report MPKI and cycles");
+KNOB<UINT64> KnobPageSize(KNOB_MODE_WRITEONCE, "pintool", "pagesize", "4096",
+    "page size of the TLB model in bytes, 4096 or 2097152");
+KNOB<UINT32> KnobItlbEntries(KNOB_MODE_WRITEONCE, "pintool", "itlbentries", "128", "L1 ITLB entries");
+KNOB<UINT32> KnobItlbAssoc(KNOB_MODE_WRITEONCE, "pintool", "itlbassoc", "8", "L1 ITLB associativity");
+KNOB<UINT32> KnobDtlbEntries(KNOB_MODE_WRITEONCE, "pintool", "dtlbentries", "64", "L1 DTLB entries");
+KNOB<UINT32> KnobDtlbAssoc(KNOB_MODE_WRITEONCE, "pintool", "dtlbassoc", "4", "L1 DTLB associativity");
+KNOB<UINT32> KnobStlbEntries(KNOB_MODE_WRITEONCE, "pintool", "stlbentries", "1536", "L2 STLB entries");
+KNOB<UINT32> KnobStlbAssoc(KNOB_MODE_WRITEONCE, "pintool", "stlbassoc", "12", "L2 STLB associativity");
+KNOB<UINT32> KnobStlbLatency(KNOB_MODE_WRITEONCE, "pintool", "stlblat", "7",
+    "cycles added by an L1 TLB miss that hits in the STLB");
+KNOB<UINT32> KnobWalkLatency(KNOB_MODE_WRITEONCE, "pintool", "walklat", "30",
+    "cycles added by a page walk after an STLB miss");
+
+KNOB<UINT64> KnobBbvInterval(KNOB_MODE_WRITEONCE, "pintool", "bbv", "0",
+    "profile the whole run and write a basic block vector every <n> million instructions instead of measuring the window");
+KNOB<string> KnobBbvFile(KNOB_MODE_WRITEONCE, "pintool", "bbvfile", "HW1.bb",
+    "basic block vector file prefix, the thread id is appended");
+
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool", "interval", "0",
+    "record the counters of every <n> million instructions of the window, 0 to disable");
+KNOB<string> KnobIntervalFile(KNOB_MODE_WRITEONCE, "pintool", "intervalfile", "HW1.intervals",
+    "binary interval record file, read with the intervals program");
+
+/* ===================================================================== */
+// Utilities
+/* ===================================================================== */
+
+/*!
+ *  Print out help message.
+ */
+INT32 Usage()
+{
+    cerr << "This tool prints out the number of dynamically executed " << endl
+         << "instructions, basic blocks and threads in the application." << endl
+         << endl;
+
+    cerr << KNOB_BASE::StringKnobSummary() << endl;
+
+    return -1;
+}
+
+/*!
+ * Check that a cache level built from the -line knob and the given size and
+ * associativity has a power-of-two number of sets.
+ */
+static BOOL ValidCacheGeometry(UINT64 size, UINT32 assoc)
+{
+    UINT64 line = KnobLineSize.Value();
+    if (line == 0 || (line & (line - 1)) || assoc == 0) return FALSE;
+    UINT64 sets = size / line / assoc;
+    return sets > 0 && !(sets & (sets - 1)) && sets * line * assoc == size;
+}
+
+/*!
+ * Check that a TLB has a power-of-two number of sets.
+ */
+static BOOL ValidTlbGeometry(UINT32 entries, UINT32 assoc)
+{
+    if (assoc == 0 || entries % assoc) return FALSE;
+    UINT32 sets = entries / assoc;
+    return sets > 0 && !(sets & (sets - 1));
+}
+
+/*!
+ * Parse a comma-separated list of footprint granularities.
+ * @param[in]   list        granularities in bytes, e.g. "32,64,4096"
+ * @param[out]  bits        log2 of each granularity
+ * @return FALSE if an entry is not a power of two
+ */
+static BOOL ParseGranularities(const string& list, std::vector<UINT32>& bits)
+{
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t comma = list.find(',', pos);
+        if (comma == string::npos) comma = list.size();
+        UINT64 gran = strtoull(list.substr(pos, comma - pos).c_str(), NULL, 0);
+        if (gran == 0 || (gran & (gran - 1)) || gran > (1ULL << 40)) return FALSE;
+        bits.push_back(__builtin_ctzll(gran));
+        pos = comma + 1;
+    }
+    return TRUE;
+}
+
+/*!
+ * Parse a comma-separated list of instruction window sizes.
+ * @return FALSE if an entry is not a positive number
+ */
+static BOOL ParseWindowSizes(const string& list, std::vector<UINT32>& windows)
+{
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t comma = list.find(',', pos);
+        if (comma == string::npos) comma = list.size();
+        UINT64 window = strtoull(list.substr(pos, comma - pos).c_str(), NULL, 0);
+        if (window == 0 || window > (1U << 24)) return FALSE;
+        windows.push_back((UINT32)window);
+        pos = comma + 1;
+    }
+    return TRUE;
+}
+
+/* ===================================================================== */
+// Analysis routines
+/* ===================================================================== */
+
+/*!
+ * Increase the running thread's counters of executed basic blocks and instructions.
+ * This function is called for every basic block when it is about to be executed.
+ * The counters are private to the thread; its instructions are added to the
+ * shared icount in batches of ICOUNT_BATCH by PublishIcount(), so the window
+ * boundaries are placed within one batch per thread.
+ * @param[in]   td              counter block of the running thread
+ * @param[in]   numInstInBbl    number of instructions in the basic block
+ * @return whether the thread's unpublished instructions fill a batch
+ */
+ADDRINT CountBbl(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    td->bbls++;
+    td->ins += numInstInBbl;
+    td->unpublishedIns += numInstInBbl;
+    return td->unpublishedIns >= ICOUNT_BATCH;
+}
+
+// Add the running thread's unpublished instructions to icount and return the new total
+static inline UINT64 PublishIcount(THREAD_DATA* td)
+{
+    UINT64 total = __sync_add_and_fetch(&icount, td->unpublishedIns);
+    td->unpublishedIns = 0;
+    return total;
+}
+
+// Analysis routine to check fast-forward condition
+ADDRINT FastForward(void) {
+	return (icount >= fast_forward_count);
+}
+
+// PHASE_ROI window check: is the running thread inside the region of interest
+ADDRINT InRoi(THREAD_DATA* td) {
+    return td->roiDepth;
+}
+
+// Window check for analysis routines of the guarded phases that get the thread's counters
+static inline ADDRINT InWindow(THREAD_DATA* td) {
+    return phase == PHASE_ROI ? InRoi(td) : FastForward();
+}
+
+/*!
+ * Enter the region of interest, at the start of the routine or a start marker.
+ * Entries of a routine nested in itself count once.
+ * @return non-zero when the thread was outside the region
+ */
+ADDRINT EnterRoi(THREAD_DATA* td)
+{
+    if (td->roiDepth++) return 0;
+    td->roiEntries++;
+    return 1;
+}
+
+// Leave the region of interest; stray stop markers are ignored
+VOID ExitRoi(THREAD_DATA* td)
+{
+    if (td->roiDepth) td->roiDepth--;
+}
+
+// PHASE_GUARDED window check of a block record, which notes whether the thread's trace has started
+ADDRINT GuardedBlockRecordDue(THREAD_DATA* td)
+{
+    td->traceStarted = FastForward();
+    return td->traceStarted;
+}
+
+// PHASE_GUARDED: has the window opened since the head of the thread's current block
+ADDRINT GuardedPartialBlockDue(THREAD_DATA* td)
+{
+    if (td->traceStarted || !FastForward()) return 0;
+    td->traceStarted = TRUE;
+    return 1;
+}
+
+/*!
+ * Fast version: count a basic block towards the gap before the next sample.
+ * The block that would take the gap past its length is left out: it starts the
+ * sample and is counted by SampleDone() when it re-executes in the detailed version.
+ */
+ADDRINT SampleGapDone(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    if (td->sampleIns + numInstInBbl > sampleGap) return 1;
+    td->sampleIns += numInstInBbl;
+    return 0;
+}
+
+/*!
+ * Start a sample of the running thread.
+ * The basic block is taken out of the instruction counts again because it is
+ * re-executed in the detailed version, which counts it itself.
+ * @return VERSION_DETAILED, which Pin stores in versionReg
+ */
+ADDRINT StartSample(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    td->bbls--;
+    td->ins -= numInstInBbl;
+    td->sampleIns = 0;
+    std::copy(td->counts, td->counts + NUM_INS_TYPES, td->sampleStart);
+    td->sampleStart[NUM_INS_TYPES] = td->cycles;
+    return VERSION_DETAILED;
+}
+
+/*!
+ * Detailed version: count a basic block towards the current sample.
+ * As in SampleGapDone(), the block that would take the sample past its length
+ * ends it and goes to the next gap; a sample holds at least one block.
+ */
+ADDRINT SampleDone(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    if (td->sampleIns && td->sampleIns + numInstInBbl > sampleLength) return 1;
+    td->sampleIns += numInstInBbl;
+    return 0;
+}
+
+/*!
+ * Finish a sample of the running thread and add its category shares and CPI
+ * to the thread's sample statistics. The basic block is re-executed in the
+ * fast version and taken out of the instruction counts as in StartSample().
+ * @return VERSION_FAST, which Pin stores in versionReg
+ */
+ADDRINT EndSample(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    td->bbls--;
+    td->ins -= numInstInBbl;
+    td->sampleIns = 0;
+    UINT64 total = 0;
+    for (UINT32 i = 0; i < NUM_INS_TYPES; i++) {
+        total += td->counts[i] - td->sampleStart[i];
+    }
+    if (total == 0) return VERSION_FAST;
+
+    SAMPLE_STATS& stats = td->sampleStats;
+    stats.samples++;
+    for (UINT32 i = 0; i <= NUM_INS_TYPES; i++) {
+        UINT64 now = (i < NUM_INS_TYPES) ? td->counts[i] : td->cycles;
+        double x = (double)(now - td->sampleStart[i]) / total;
+        stats.sum[i] += x;
+        stats.sumSq[i] += x * x;
+    }
+    return VERSION_FAST;
+}
+
+/*!
+ * Fast-forward phase: publish a batch of the thread's instructions and switch to
+ * the detailed phase once the fast-forward count has been crossed.
+ * The basic block that crosses it is taken out of the counts again because it is
+ * re-executed under the detailed instrumentation, which counts it itself.
+ * @param[in]   td              counter block of the running thread
+ * @param[in]   numInstInBbl    number of instructions in the basic block
+ * @param[in]   ctxt            register state at the start of the basic block
+ */
+VOID StartWindow(THREAD_DATA* td, UINT32 numInstInBbl, CONTEXT* ctxt)
+{
+    if (PublishIcount(td) < fast_forward_count) return;
+    td->bbls--;
+    td->ins -= numInstInBbl;
+    __sync_fetch_and_sub(&icount, (UINT64)numInstInBbl);
+    phase = PHASE_DETAILED;
+    PIN_RemoveInstrumentation();
+    PIN_ExecuteAt(ctxt);
+}
+
+/*!
+ * Translate an address through a first-level TLB and the STLB of a thread.
+ * @return the cycles the translation adds: 0 on a first-level hit
+ */
+static inline UINT32 Translate(THREAD_DATA* td, CACHE* tlb, ADDRINT addr)
+{
+    if (tlb->Access(addr)) return 0;
+    if (td->stlb->Access(addr)) return td->stlb->Latency();
+    return walkLatency;
+}
+
+/*!
+ * Record instruction footprint.
+ * This analysis routine is called once per basic block with the bytes of all its
+ * instructions (all instructions are counted regardless of predicate).
+ * It marks the 32-byte chunks the basic block touches in the instruction bitmap,
+ * and adds them to the instruction footprint estimate when -hll is given.
+ * With -tlb the instruction fetches are translated through the ITLB once per page
+ * the basic block spans.
+ */
+inline VOID RecordInsFootprint(THREAD_DATA* td, ADDRINT addr, UINT32 size)
+{
+    if (exactFootprint) {
+        td->insChunks.Insert(addr, size);
+    }
+    if (td->insSketch) {
+        td->insSketch->Insert(addr, size);
+    }
+    if (tlbModel) {
+        UINT64 lastPage = ((UINT64)addr + std::max<UINT32>(size, 1) - 1) >> pageBits;
+        for (UINT64 page = (UINT64)addr >> pageBits; page <= lastPage; page++) {
+            td->tlbCycles += Translate(td, td->itlb, page << pageBits);
+        }
+    }
+}
+
+/*!
+ * Record data footprint.
+ * Called for each memory access (load or store) with true predicate when the
+ * trace buffer holding it is processed.
+ * It marks the 32-byte chunks the memory access touches in the data bitmap.
+ */
+inline VOID RecordDataFootprint(THREAD_DATA* td, ADDRINT ea, UINT32 size)
+{
+    td->dataChunks.Insert(ea, size);
+}
+
+/*!
+ * Add one execution of a basic block to the basic block vector of the running thread.
+ * Blocks are weighted by their instruction count, as SimPoint expects.
+ * @return non-zero when the current interval is complete
+ */
+ADDRINT CountBbv(THREAD_DATA* td, UINT32 id, UINT32 numInstInBbl)
+{
+    if (id >= td->bbv.size()) td->bbv.resize(id + 1, 0);
+    td->bbv[id] += numInstInBbl;
+    td->bbvIns += numInstInBbl;
+    return td->bbvIns >= bbvInterval;
+}
+
+/*!
+ * Append the current basic block vector of a thread to its file and start a new
+ * interval. The line uses the SimPoint frequency vector format
+ * "T:<id>:<count> :<id>:<count> ..." with ids starting at 1.
+ */
+VOID WriteBbv(THREAD_DATA* td)
+{
+    std::ostream& bbvOut = *td->bbvOut;
+    bbvOut << "T";
+    for (size_t id = 0; id < td->bbv.size(); id++) {
+        if (td->bbv[id]) {
+            bbvOut << ":" << id + 1 << ":" << td->bbv[id] << " ";
+            td->bbv[id] = 0;
+        }
+    }
+    bbvOut << "\n";
+    td->bbvIns = 0;
+}
+
+/*!
+ * Count the instructions of a basic block towards the current interval of the
+ * running thread.
+ * @return non-zero when the interval is complete
+ */
+ADDRINT IntervalDue(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    td->intervalIns += numInstInBbl;
+    return td->intervalIns >= intervalLength;
+}
+
+// IntervalDue() for the guarded phases, where only blocks inside the window count
+ADDRINT GuardedIntervalDue(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    return InWindow(td) && IntervalDue(td, numInstInBbl);
+}
+
+/*!
+ * Append the buffered interval records of a thread to the interval file.
+ */
+static VOID FlushIntervals(THREAD_DATA* td)
+{
+    UINT32 pending = td->numIntervals % INTERVAL_BUFFER_RECORDS;
+    if (pending == 0 && td->numIntervals) pending = INTERVAL_BUFFER_RECORDS;
+    PIN_GetLock(&intervalLock, td->tid + 1);
+    intervalOut->write(reinterpret_cast<const char*>(td->intervalBuf), pending * sizeof(INTERVAL_RECORD));
+    PIN_ReleaseLock(&intervalLock);
+}
+
+/*!
+ * Close the current interval of a thread: store the counter differences since
+ * its start in the record buffer, which is written out once it is full.
+ * New data chunks are only seen once the memory access buffer holding them has
+ * been processed, so they may be attributed to a later interval.
+ */
+VOID EndInterval(THREAD_DATA* td)
+{
+    INTERVAL_RECORD& start = td->intervalStart;
+    INTERVAL_RECORD& rec = td->intervalBuf[td->numIntervals % INTERVAL_BUFFER_RECORDS];
+    rec.tid = td->tid;
+    rec.index = td->numIntervals;
+    rec.instructions = td->intervalIns;
+    for (UINT32 i = 0; i < NUM_INS_TYPES; i++) {
+        rec.counts[i] = td->counts[i] - start.counts[i];
+        start.counts[i] = td->counts[i];
+    }
+    rec.cycles = td->cycles - start.cycles;
+    UINT64 insTotal = exactFootprint ? td->insChunks.Chunks() : td->insSketch->Estimate();
+    UINT64 dataTotal = exactFootprint ? td->dataChunks.Chunks() : td->dataSketch->Estimate();
+    rec.insChunks = insTotal - std::min(insTotal, start.insChunks);
+    rec.dataChunks = dataTotal - std::min(dataTotal, start.dataChunks);
+    start.cycles = td->cycles;
+    start.insChunks = insTotal;
+    start.dataChunks = dataTotal;
+
+    td->intervalIns = 0;
+    if (++td->numIntervals % INTERVAL_BUFFER_RECORDS == 0) FlushIntervals(td);
+}
+
+/*!
+ * Count the instructions of a basic block towards the current working set window
+ * of the running thread.
+ * @return non-zero when the window is complete
+ */
+ADDRINT WorkingSetDue(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    td->wsIns += numInstInBbl;
+    return td->wsIns >= wsLength;
+}
+
+// WorkingSetDue() for the guarded phases, where only blocks inside the window count
+ADDRINT GuardedWorkingSetDue(THREAD_DATA* td, UINT32 numInstInBbl)
+{
+    return InWindow(td) && WorkingSetDue(td, numInstInBbl);
+}
+
+/*!
+ * Start the next working set window of the running thread.
+ * @return the new window number, which Pin stores in epochReg
+ */
+ADDRINT NextWorkingSetWindow(THREAD_DATA* td)
+{
+    td->wsIns = 0;
+    return ++td->wsWindow;
+}
+
+/*!
+ * Write the working set of the current window of a thread, and of the windows
+ * without data accesses up to the given one, then start that window.
+ */
+static VOID EndWorkingSetWindows(THREAD_DATA* td, UINT32 next)
+{
+    WORKING_SET* ws = td->workingSet;
+    PIN_GetLock(&wsLock, td->tid + 1);
+    for (UINT32 w = ws->Window(); w < next; w++) {
+        *wsOut << td->tid << " " << w << " " << ws->Pages() << " " << ws->Lines() << "\n";
+        ws->StartWindow(w + 1);
+    }
+    PIN_ReleaseLock(&wsLock);
+}
+
+/*!
+ * Print the counts of the values 0..maxShown of a histogram, followed by the
+ * overflow bucket if anything landed in it.
+ */
+template <UINT32 NUM_BUCKETS>
+static VOID PrintHistogram(const char* title, const HISTOGRAM<NUM_BUCKETS>& hist, UINT32 maxShown)
+{
+    *out << title << "\n";
+    for (UINT32 i = 0; i <= maxShown; i++) {
+        *out << i << " : " << hist[i] << "\n";
+    }
+    if (hist.Overflow()) {
+        *out << ">=" << NUM_BUCKETS << " : " << hist.Overflow() << "\n";
+    }
+    *out << "\n";
+}
+
+/*!
+ * Print the register dependence distance histograms of all reads and of the
+ * reads of load-produced values side by side.
+ */
+static VOID PrintDependenceDistances(const DEPENDENCE_DISTANCES& deps)
+{
+    const HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS>& all = deps.All();
+    const HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS>& loaded = deps.Loaded();
+    UINT32 lastBucket = 0;
+    for (UINT32 b = 1; b < REUSE_DISTANCE::NUM_BUCKETS; b++) {
+        if (all[b]) lastBucket = b;
+    }
+
+    *out << "Register Dependence Distance Results (all reads, load-produced values): \n";
+    for (UINT32 b = 1; b <= lastBucket; b++) {
+        *out << "[" << (1ULL << (b - 1)) << ", " << (1ULL << b) << ") : " << all[b] << " " << loaded[b] << "\n";
+    }
+    if (all.Overflow()) {
+        *out << ">=" << (1ULL << (REUSE_DISTANCE::NUM_BUCKETS - 1)) << " : " << all.Overflow()
+             << " " << loaded.Overflow() << "\n";
+    }
+    *out << "No producer in the window : " << deps.NoProducer() << "\n\n";
+}
+
+/*!
+ * Print a reuse distance histogram followed by the miss ratio of a fully
+ * associative LRU cache of every power-of-two number of blocks it covers.
+ * Distances are per thread, so the curve describes private caches.
+ */
+static VOID PrintReuseDistances(const REUSE_DISTANCE& reuse)
+{
+    const HISTOGRAM<REUSE_DISTANCE::NUM_BUCKETS>& dist = reuse.Distances();
+    UINT64 blockSize = 1ULL << reuse.BlockBits();
+    UINT64 accesses = reuse.ColdMisses() + dist.Overflow();
+    UINT32 lastBucket = 0;
+    for (UINT32 b = 0; b < REUSE_DISTANCE::NUM_BUCKETS; b++) {
+        accesses += dist[b];
+        if (dist[b]) lastBucket = b;
+    }
+
+    *out << "Reuse distance Results at " << blockSize << " bytes: \n";
+    *out << "0 : " << dist[0] << "\n";
+    for (UINT32 b = 1; b <= lastBucket; b++) {
+        *out << "[" << (1ULL << (b - 1)) << ", " << (1ULL << b) << ") : " << dist[b] << "\n";
+    }
+    if (dist.Overflow()) {
+        *out << ">=" << (1ULL << (REUSE_DISTANCE::NUM_BUCKETS - 1)) << " : " << dist.Overflow() << "\n";
+    }
+    *out << "Cold : " << reuse.ColdMisses() << "\n";
+
+    // A cache of 2^b blocks hits on the distances of buckets 0..b
+    UINT64 misses = accesses;
+    for (UINT32 b = 0; b <= lastBucket; b++) {
+        misses -= dist[b];
+        *out << "Miss ratio of a fully associative " << (blockSize << b) << " byte cache : "
+             << (accesses ? (double)misses / accesses : 0) << "\n";
+    }
+    *out << "\n";
+}
+
+/*!
+ * Run one load/store micro-op through the cache model.
+ * @return the latency of the level that hit
+ */
+static UINT32 SimulateDataAccess(THREAD_DATA* td, THREADID tid, ADDRINT addr)
+{
+    if (td->l1d->Access(addr)) return td->l1d->Latency();
+    if (td->l2->Access(addr)) return td->l2->Latency();
+
+    PIN_GetLock(&llcLock, tid + 1);
+    BOOL hit = llc->Access(addr);
+    PIN_ReleaseLock(&llcLock);
+    return hit ? llc->Latency() : memLatency;
+}
+
+/*!
+ * Run the data-stream analyses over a batch of recorded accesses of one thread.
+ * As in Part B, the cache model splits each access into 4-byte micro-ops.
+ * When a trace file is recorded, the batch is appended to the trace first and
+ * the analyses then run over its data accesses only.
+ */
+static VOID ProcessMemRefs(THREAD_DATA* td, THREADID tid, const MEM_REF* refs, UINT64 numRefs)
+{
+    if (td->trace) {
+        td->trace->Append(refs, numRefs);
+        refs = td->trace->Accesses().data();
+        numRefs = td->trace->Accesses().size();
+    }
+    if (exactFootprint) {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            RecordDataFootprint(td, refs[i].ea, refs[i].size);
+        }
+    }
+    if (tlbModel) {
+        // An access crossing a page boundary is translated once per page
+        for (UINT64 i = 0; i < numRefs; i++) {
+            ADDRINT last = refs[i].ea + std::max<UINT32>(refs[i].size, 1) - 1;
+            td->tlbCycles += Translate(td, td->dtlb, refs[i].ea);
+            if ((last >> pageBits) != (refs[i].ea >> pageBits)) td->tlbCycles += Translate(td, td->dtlb, last);
+        }
+    }
+    if (td->dataSketch) {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            td->dataSketch->Insert(refs[i].ea, refs[i].size);
+        }
+    }
+
+    if (td->workingSet) {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            if (refs[i].window != td->workingSet->Window()) EndWorkingSetWindows(td, refs[i].window);
+            td->workingSet->Access(refs[i].ea, refs[i].size);
+        }
+    }
+
+    if (td->loadPatterns) {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            if (refs[i].flags & MEM_REF_WRITE) continue;
+            td->loadPatterns->Access(refs[i].pc, refs[i].ea, refs[i].flags & MEM_REF_CHASE);
+        }
+    }
+
+    for (size_t r = 0; r < td->reuse.size(); r++) {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            td->reuse[r]->Access(refs[i].ea, refs[i].size);
+        }
+    }
+
+    if (cacheModel) {
+        for (UINT64 i = 0; i < numRefs; i++) {
+            for (UINT32 offset = 0; offset < refs[i].size; offset += 4) {
+                td->memCycles += SimulateDataAccess(td, tid, refs[i].ea + offset);
+            }
+        }
+    }
+}
+
+/*!
+ * Run one executed instruction through every dataflow model of the thread.
+ * @param[in]   ea0, ea1    effective addresses of the first two memory operands
+ */
+VOID DataflowIns(THREAD_DATA* td, const DATAFLOW_INS* ins, ADDRINT ea0, ADDRINT ea1)
+{
+    const ADDRINT ea[DATAFLOW_MEM_OPERANDS] = { ea0, ea1 };
+    for (size_t w = 0; w < td->dataflow.size(); w++) {
+        td->dataflow[w]->Execute(ins, ea);
+    }
+}
+
+// Record the register dependence distances of one executed instruction
+VOID DependenceIns(THREAD_DATA* td, const DATAFLOW_INS* ins)
+{
+    td->dependences->Execute(ins);
+}
+
+/*!
+ * Called by Pin when a thread's memory access buffer is full, and with the
+ * remaining accesses when the thread exits.
+ * @param[in]   tid             ID of the thread owning the buffer
+ * @param[in]   buf             the recorded MEM_REFs
+ * @param[in]   numElements     number of MEM_REFs in the buffer
+ * @return the buffer to reuse for the thread
+ */
+VOID* MemBufferFull(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 numElements, VOID* v)
+{
+    THREAD_DATA* td = static_cast<THREAD_DATA*>(PIN_GetThreadData(tlsKey, tid));
+    ProcessMemRefs(td, tid, static_cast<const MEM_REF*>(buf), numElements);
+    return buf;
+}
+
+// Executions of a COUNT_DELTA summed over all threads
+static UINT64 DeltaExecutions(const COUNT_DELTA* delta)
+{
+    UINT64 total = 0;
+    for (size_t t = 0; t < threadData.size(); t++) {
+        total += threadData[t]->execPages[delta->id >> EXEC_PAGE_BITS][delta->id & ((1 << EXEC_PAGE_BITS) - 1)];
+    }
+    return total;
+}
+
+/*!
+ * Sum the per-thread Part A/B counters and union the per-thread footprint bitmaps.
+ */
+static VOID MergeThreadData()
+{
+    insChunks = new CHUNK_BITMAP(footprintChunkBits);
+    dataChunks = new CHUNK_BITMAP(footprintChunkBits);
+    if (strideAnalysis) {
+        loadPatterns = new LOAD_PATTERNS();
+    }
+    if (dependenceAnalysis) {
+        dependences = new DEPENDENCE_DISTANCES();
+    }
+    if (sketchPrecision) {
+        insSketch = new CHUNK_SKETCH(FOOTPRINT_BITS, sketchPrecision);
+        dataSketch = new CHUNK_SKETCH(FOOTPRINT_BITS, sketchPrecision);
+    }
+    for (size_t r = 0; r < reuseBlockBits.size(); r++) {
+        reuseDists.push_back(new REUSE_DISTANCE(reuseBlockBits[r]));
+    }
+    for (size_t t = 0; t < threadData.size(); t++) {
+        THREAD_DATA* td = threadData[t];
+        for (UINT32 i = 0; i < NUM_INS_TYPES; i++) {
+            g_counts[i] += td->counts[i];
+        }
+        cycle_latency += td->cycles;
+        roiEntries += td->roiEntries;
+        if (cacheModel) {
+            mem_cycles += td->memCycles;
+            l1dHits += td->l1d->Hits();
+            l1dMisses += td->l1d->Misses();
+            l2Hits += td->l2->Hits();
+            l2Misses += td->l2->Misses();
+        }
+        if (tlbModel) {
+            itlbAccesses += td->itlb->Hits() + td->itlb->Misses();
+            itlbMisses += td->itlb->Misses();
+            dtlbAccesses += td->dtlb->Hits() + td->dtlb->Misses();
+            dtlbMisses += td->dtlb->Misses();
+            stlbAccesses += td->stlb->Hits() + td->stlb->Misses();
+            stlbMisses += td->stlb->Misses();
+            tlb_cycles += td->tlbCycles;
+        }
+        insChunks->Merge(td->insChunks);
+        dataChunks->Merge(td->dataChunks);
+        if (sketchPrecision) {
+            insSketch->Merge(*td->insSketch);
+            dataSketch->Merge(*td->dataSketch);
+        }
+        for (size_t r = 0; r < td->reuse.size(); r++) {
+            reuseDists[r]->Merge(*td->reuse[r]);
+        }
+        if (strideAnalysis) {
+            loadPatterns->Merge(*td->loadPatterns);
+        }
+        if (dependenceAnalysis) {
+            dependences->Merge(*td->dependences);
+        }
+    }
+}
+
+/*!
+ * Fold the static instruction records into the Part D statistics, weighting each
+ * one by the number of times it executed (for the properties collected over all
+ * instructions) or executed with a true predicate (for the memory properties).
+ */
+static VOID AccumulateStaticStats()
+{
+    for (size_t i = 0; i < insRecords.size(); i++) {
+        const INS_RECORD& rec = insRecords[i];
+        UINT64 executed = DeltaExecutions(rec.block);
+        UINT64 predicated = DeltaExecutions(rec.predicated);
+
+        if (executed) {
+            // 1-4. Length, operand and register operand distributions (all instructions)
+            insLengthDist.Add(rec.size, executed);
+            operandCountDist.Add(rec.operands, executed);
+            regReadDist.Add(rec.regReads, executed);
+            regWriteDist.Add(rec.regWrites, executed);
+
+            // 9. Immediate value statistics
+            if (rec.hasImm) {
+                maxImm = std::max(maxImm, rec.maxImm);
+                minImm = std::min(minImm, rec.minImm);
+            }
+        }
+
+        if (predicated) {
+            // Instruction classes, counted like Part A for the executions with a true predicate
+            iclassCounts[rec.iclass] += predicated;
+            extensionCounts[rec.extension] += predicated;
+
+            // 5. Memory operand distribution
+            memOpDist.Add(rec.memReads + rec.memWrites, predicated);
+
+            // 6-8. Memory read/write distributions and bytes touched (memory instructions)
+            if (rec.memOperands > 0) {
+                memReadDist.Add(rec.memReads, predicated);
+                memWriteDist.Add(rec.memWrites, predicated);
+                maxMemBytes = std::max(maxMemBytes, (UINT64)rec.memBytes);
+                totalMemBytes += (UINT64)rec.memBytes * predicated;
+                memInstCount += predicated;
+            }
+
+            // 10. Displacement statistics
+            if (rec.hasDisp) {
+                maxDisp = std::max(maxDisp, rec.maxDisp);
+                minDisp = std::min(minDisp, rec.minDisp);
+            }
+        }
+    }
+}
+
+static bool MoreCycles(const HOT_CODE& a, const HOT_CODE& b) { return a.cycles > b.cycles; }
+static bool MoreExecutions(const HOT_CODE& a, const HOT_CODE& b) { return a.executions > b.executions; }
+
+// Image and routine containing a code address
+static string CodeLocation(ADDRINT addr)
+{
+    PIN_LockClient();
+    IMG img = IMG_FindByAddress(addr);
+    string location = (IMG_Valid(img) ? IMG_Name(img) : string("?")) + " : " + RTN_FindNameByAddress(addr);
+    PIN_UnlockClient();
+    return location;
+}
+
+/*!
+ * Report the hottest basic blocks by their share of cycle_latency and the loads
+ * with the most executed read operands. Both are derived from the execution
+ * counters of the deltas, so the profile costs nothing at run time. A block is
+ * charged the cycles of its unpredicated instructions on every execution and
+ * those of its predicated instructions on executions with a true predicate.
+ * @param[in]   topK    number of blocks and loads to print
+ */
+static VOID PrintHotCode(UINT32 topK)
+{
+    // Cycles of the predicated instructions, charged to the block they belong to
+    std::map<const COUNT_DELTA*, UINT64> predicatedCycles;
+    std::map<ADDRINT, HOT_CODE> loads;
+    for (size_t i = 0; i < insRecords.size(); i++) {
+        const INS_RECORD& rec = insRecords[i];
+        UINT64 predicated = DeltaExecutions(rec.predicated);
+        if (rec.predicated != rec.block) {
+            predicatedCycles[rec.block] += rec.predicated->cycles * predicated;
+        }
+        if (rec.memReads && predicated) {
+            HOT_CODE& load = loads[rec.pc];
+            load.addr = rec.pc;
+            load.numIns = 1;
+            load.executions += (UINT64)rec.memReads * predicated;
+        }
+    }
+
+    std::map<ADDRINT, HOT_CODE> blocks;
+    for (size_t i = 0; i < blockRecords.size(); i++) {
+        const BLOCK_RECORD& rec = blockRecords[i];
+        UINT64 executions = DeltaExecutions(rec.delta);
+        if (!executions) continue;
+        HOT_CODE& block = blocks[rec.addr];
+        block.addr = rec.addr;
+        block.numIns = std::max(block.numIns, rec.numIns);
+        block.executions += executions;
+        block.cycles += rec.delta->cycles * executions + predicatedCycles[rec.delta];
+    }
+
+    std::vector<HOT_CODE> hot;
+    for (std::map<ADDRINT, HOT_CODE>::iterator it = blocks.begin(); it != blocks.end(); ++it) hot.push_back(it->second);
+    std::sort(hot.begin(), hot.end(), MoreCycles);
+    *out << "Hot basic blocks: \n";
+    for (size_t i = 0; i < hot.size() && i < topK; i++) {
+        *out << hexstr(hot[i].addr) << " : " << hot[i].executions << " executions, " << hot[i].numIns
+             << " instructions, " << hot[i].cycles << " cycles ("
+             << (cycle_latency ? (float)hot[i].cycles / cycle_latency : 0) << ") "
+             << CodeLocation(hot[i].addr) << "\n";
+    }
+    *out << "\n";
+
+    UINT64 totalLoads = 0;
+    hot.clear();
+    for (std::map<ADDRINT, HOT_CODE>::iterator it = loads.begin(); it != loads.end(); ++it) {
+        hot.push_back(it->second);
+        totalLoads += it->second.executions;
+    }
+    std::sort(hot.begin(), hot.end(), MoreExecutions);
+    *out << "Hot loads: \n";
+    for (size_t i = 0; i < hot.size() && i < topK; i++) {
+        *out << hexstr(hot[i].addr) << " : " << hot[i].executions << " accesses ("
+             << (totalLoads ? (float)hot[i].executions / totalLoads : 0) << ") "
+             << CodeLocation(hot[i].addr) << "\n";
+    }
+    *out << "\n";
+}
+
+/*!
+ * Dominant access pattern of a load PC, ties going to the earlier pattern.
+ */
+static LOAD_PATTERN DominantPattern(const STRIDE_ENTRY& entry)
+{
+    UINT32 best = 0;
+    for (UINT32 p = 1; p < NUM_LOAD_PATTERNS; p++) {
+        if (entry.counts[p] > entry.counts[best]) best = p;
+    }
+    return (LOAD_PATTERN)best;
+}
+
+static bool MoreLoads(const std::pair<ADDRINT, UINT64>& a, const std::pair<ADDRINT, UINT64>& b)
+{
+    return a.second > b.second;
+}
+
+/*!
+ * Report the share of the dynamic loads in each access pattern, the load PCs by
+ * their dominant pattern, and the topK most executed load PCs.
+ */
+static VOID PrintLoadPatterns(UINT32 topK)
+{
+    const std::unordered_map<ADDRINT, STRIDE_ENTRY>& table = loadPatterns->Table();
+    UINT64 loads[NUM_LOAD_PATTERNS] = {0};
+    UINT64 pcs[NUM_LOAD_PATTERNS] = {0};
+    UINT64 totalLoads = 0;
+    std::vector<std::pair<ADDRINT, UINT64> > byCount;
+    for (std::unordered_map<ADDRINT, STRIDE_ENTRY>::const_iterator it = table.begin(); it != table.end(); ++it) {
+        UINT64 count = 0;
+        for (UINT32 p = 0; p < NUM_LOAD_PATTERNS; p++) {
+            loads[p] += it->second.counts[p];
+            count += it->second.counts[p];
+        }
+        pcs[DominantPattern(it->second)]++;
+        totalLoads += count;
+        byCount.push_back(std::make_pair(it->first, count));
+    }
+
+    *out << "Load Pattern Results: \n";
+    for (UINT32 p = 0; p < NUM_LOAD_PATTERNS; p++) {
+        *out << loadPatternNames[p] << ": " << loads[p] << " (" << (totalLoads ? (float)loads[p] / totalLoads : 0)
+             << ") in " << pcs[p] << " load PCs\n";
+    }
+    *out << "Stride prefetcher coverage : " << (totalLoads ? (float)loads[PATTERN_STRIDE] / totalLoads : 0) << "\n";
+
+    std::sort(byCount.begin(), byCount.end(), MoreLoads);
+    for (size_t i = 0; i < byCount.size() && i < topK; i++) {
+        const STRIDE_ENTRY& entry = table.find(byCount[i].first)->second;
+        *out << hexstr(byCount[i].first) << " : " << byCount[i].second << " loads, "
+             << loadPatternNames[DominantPattern(entry)] << ", last stride " << entry.stride << " "
+             << CodeLocation(byCount[i].first) << "\n";
+    }
+    *out << "\n";
+}
+
+static bool MoreFrequent(const std::pair<UINT32, UINT64>& a, const std::pair<UINT32, UINT64>& b)
+{
+    return a.second > b.second;
+}
+
+/*!
+ * Print the non-zero entries of a dense histogram, most frequent first.
+ * @param[in]   name    name of an entry, OPCODE_StringShort() or EXTENSION_StringShort()
+ */
+static VOID PrintClassHistogram(const char* title, const UINT64* counts, UINT32 size, string (*name)(UINT32))
+{
+    std::vector<std::pair<UINT32, UINT64> > byCount;
+    UINT64 total = 0;
+    for (UINT32 i = 0; i < size; i++) {
+        if (counts[i]) byCount.push_back(std::make_pair(i, counts[i]));
+        total += counts[i];
+    }
+    std::sort(byCount.begin(), byCount.end(), MoreFrequent);
+
+    *out << title << "\n";
+    for (size_t i = 0; i < byCount.size(); i++) {
+        *out << name(byCount[i].first) << " : " << byCount[i].second
+             << " (" << (float)byCount[i].second / total << ")\n";
+    }
+    *out << "\n";
+}
+
+/*!
+ * Print the sampled estimates of the category shares and the CPI, each with the
+ * half-width of its 95% confidence interval from the variance between samples.
+ */
+static VOID PrintSampleEstimates()
+{
+    SAMPLE_STATS stats = SAMPLE_STATS();
+    for (size_t t = 0; t < threadData.size(); t++) {
+        const SAMPLE_STATS& ts = threadData[t]->sampleStats;
+        stats.samples += ts.samples;
+        for (UINT32 i = 0; i <= NUM_INS_TYPES; i++) {
+            stats.sum[i] += ts.sum[i];
+            stats.sumSq[i] += ts.sumSq[i];
+        }
+    }
+
+    *out << "Sampling Results: " << stats.samples << " samples of " << sampleLength
+         << " instructions every " << sampleGap + sampleLength << " instructions\n";
+    if (stats.samples < 2) {
+        *out << "Too few samples for confidence intervals\n\n";
+        return;
+    }
+    double n = stats.samples;
+    for (UINT32 i = 0; i <= NUM_INS_TYPES; i++) {
+        double mean = stats.sum[i] / n;
+        double variance = std::max(0.0, (stats.sumSq[i] - n * mean * mean) / (n - 1));
+        double halfWidth = 1.96 * sqrt(variance / n);
+        *out << (i < NUM_INS_TYPES ? insTypeNames[i] : "CPI") << ": " << mean << " +- " << halfWidth << "\n";
+    }
+    *out << "\n";
+}
+
+/*!
+ * Print the dataflow limit study: the critical path of every window size with
+ * the resulting ILP, and the CPI per Part A/B operation to compare with the
+ * flat CPI. The threads' critical paths are summed like their Part B cycles.
+ */
+static VOID PrintDataflow(UINT64 totalOps)
+{
+    *out << "Dataflow Limit Results: \n";
+    for (size_t w = 0; w < ilpWindows.size(); w++) {
+        UINT64 cycles = 0, instructions = 0;
+        for (size_t t = 0; t < threadData.size(); t++) {
+            cycles += threadData[t]->dataflow[w]->CriticalPath();
+            instructions += threadData[t]->dataflow[w]->Instructions();
+        }
+        if (ilpWindows[w]) *out << "Window of " << ilpWindows[w] << " instructions";
+        else *out << "Unbounded window";
+        *out << " : critical path " << cycles << " cycles, ILP " << (cycles ? (double)instructions / cycles : 0)
+             << ", CPI " << (totalOps ? (double)cycles / totalOps : 0)
+             << ", speedup over flat CPI " << (cycles ? (double)cycle_latency / cycles : 0) << "\n";
+    }
+    *out << "\n";
+}
+
+/*!
+ * Merge the per-thread data and print all results.
+ * Called from Fini() once the window has been measured, after Pin has handed
+ * over the last partially filled memory access buffers.
+ */
+static VOID PrintResults()
+{
+    MergeThreadData();
+    AccumulateStaticStats();
+
+    UINT64 total_executed = 0;
+    for (UINT32 i = 0; i < NUM_INS_TYPES; i++) {
+        total_executed += g_counts[i];
+    }
+
+    *out << "===============================================\n";
+    if (phase == PHASE_ROI) {
+        *out << "Region of interest entries: " << roiEntries << "\n";
+    }
+    *out << "Instruction Type Results: \n";
+    for (UINT32 i = 0; i < NUM_INS_TYPES; i++) {
+        *out << insTypeNames[i] << ": " << g_counts[i] << " (" << (float)g_counts[i]/total_executed << ")\n";
+    }
+    *out << "CPI: " << (float)cycle_latency/total_executed << "\n";
+    if (cacheModel) {
+        // Replace the flat load/store latency by the cycles charged by the cache model
+        UINT64 flatMemCycles = (g_counts[TYPE_LOAD] + g_counts[TYPE_STORE]) * MEM_OP_LATENCY;
+        *out << "CPI (cache model): " << (float)(cycle_latency - flatMemCycles + mem_cycles)/total_executed << "\n";
+        *out << "L1D hits: " << l1dHits << " misses: " << l1dMisses << "\n";
+        *out << "L2 hits: " << l2Hits << " misses: " << l2Misses << "\n";
+        *out << "LLC hits: " << llc->Hits() << " misses: " << llc->Misses() << "\n";
+    }
+    if (tlbModel) {
+        // Translation cycles are added to the CPI of the cache model when it is enabled
+        UINT64 instructions = total_executed - g_counts[TYPE_LOAD] - g_counts[TYPE_STORE];
+        UINT64 cycles = cycle_latency;
+        if (cacheModel) cycles += mem_cycles - (g_counts[TYPE_LOAD] + g_counts[TYPE_STORE]) * MEM_OP_LATENCY;
+        *out << "TLB model with " << (1ULL << pageBits) << " byte pages\n";
+        *out << "ITLB accesses: " << itlbAccesses << " misses: " << itlbMisses
+             << " MPKI: " << (instructions ? 1000.0 * itlbMisses / instructions : 0) << "\n";
+        *out << "DTLB accesses: " << dtlbAccesses << " misses: " << dtlbMisses
+             << " MPKI: " << (instructions ? 1000.0 * dtlbMisses / instructions : 0) << "\n";
+        *out << "STLB accesses: " << stlbAccesses << " misses: " << stlbMisses
+             << " MPKI: " << (instructions ? 1000.0 * stlbMisses / instructions : 0) << "\n";
+        *out << "TLB cycles: " << tlb_cycles << "\n";
+        *out << "CPI (TLB model): " << (float)(cycles + tlb_cycles)/total_executed << "\n";
+    }
+    *out << "\n";
+
+    if (phase == PHASE_SAMPLED) {
+        PrintSampleEstimates();
+    }
+    if (!ilpWindows.empty()) {
+        PrintDataflow(total_executed);
+    }
+
+    PrintHistogram("Instruction Size Results: ", insLengthDist, 19);
+    PrintHistogram("Memory Instruction Operand Results: ", memOpDist, 4);
+    PrintHistogram("Memory Instruction Read Operand Results: ", memReadDist, 4);
+    PrintHistogram("Memory Instruction Write Operand Results: ", memWriteDist, 4);
+    PrintHistogram("Instruction Operand Results: ", operandCountDist, 9);
+    PrintHistogram("Instruction Register Read Operand Results: ", regReadDist, 9);
+    PrintHistogram("Instruction Register Write Operand Results: ", regWriteDist, 9);
+    if (dependences) {
+        PrintDependenceDistances(*dependences);
+    }
+
+    if (!exactFootprint) {
+        *out << "Instruction Blocks Accesses : " << insSketch->Estimate() << "\n";
+        *out << "Memory Blocks Accesses : " << dataSketch->Estimate() << "\n";
+        *out << "Footprint estimate standard error : " << insSketch->StandardError() << "\n";
+    } else {
+        *out << "Instruction Blocks Accesses : " << insChunks->Count(FOOTPRINT_BITS) << "\n";
+        *out << "Memory Blocks Accesses : " << dataChunks->Count(FOOTPRINT_BITS) << "\n";
+    }
+    if (exactFootprint && sketchPrecision) {
+        // -hllcheck: compare the estimates against the exact counts
+        UINT64 insExact = insChunks->Count(FOOTPRINT_BITS);
+        UINT64 dataExact = dataChunks->Count(FOOTPRINT_BITS);
+        UINT64 insEstimate = insSketch->Estimate();
+        UINT64 dataEstimate = dataSketch->Estimate();
+        *out << "Instruction Blocks estimate : " << insEstimate << " (error "
+             << (insExact ? ((double)insEstimate - insExact) / insExact : 0) << ")\n";
+        *out << "Memory Blocks estimate : " << dataEstimate << " (error "
+             << (dataExact ? ((double)dataEstimate - dataExact) / dataExact : 0) << ")\n";
+        *out << "Footprint estimate standard error : " << insSketch->StandardError() << "\n";
+    }
+    for (size_t i = 0; exactFootprint && i < footprintGranBits.size(); i++) {
+        UINT64 gran = 1ULL << footprintGranBits[i];
+        UINT64 insBlocks = insChunks->Count(footprintGranBits[i]);
+        UINT64 dataBlocks = dataChunks->Count(footprintGranBits[i]);
+        *out << "Instruction footprint at " << gran << " bytes : " << insBlocks << " (" << insBlocks * gran << " bytes)\n";
+        *out << "Data footprint at " << gran << " bytes : " << dataBlocks << " (" << dataBlocks * gran << " bytes)\n";
+    }
+    for (size_t r = 0; r < reuseDists.size(); r++) {
+        PrintReuseDistances(*reuseDists[r]);
+    }
+    if (KnobTopK.Value()) {
+        PrintHotCode(KnobTopK.Value());
+    }
+    if (loadPatterns) {
+        PrintLoadPatterns(KnobTopK.Value());
+    }
+    if (KnobIclass) {
+        PrintClassHistogram("Instruction Class Results: ", iclassCounts, XED_ICLASS_LAST, OPCODE_StringShort);
+        PrintClassHistogram("Instruction Extension Results: ", extensionCounts, XED_EXTENSION_LAST, EXTENSION_StringShort);
+    }
+    *out << "Maximum number of bytes touched by an instruction : " << maxMemBytes << "\n";
+    *out << "Average number of bytes touched by an instruction : " << (memInstCount ? (double)totalMemBytes/memInstCount : 0) << "\n";
+    *out << "Maximum value of immediate : " << maxImm << "\n";
+    *out << "Minimum value of immediate : " << minImm << "\n";
+    *out << "Maximum value of displacement used in memory addressing : " << maxDisp << "\n";
+    *out << "Minimum value of displacement used in memory addressing : " << minDisp << "\n";
+    *out << "===============================================\n";
+
+    // Final flush before closing
+    if (out != &cerr)
+    {
+        *out << std::flush;  // One final flush before closing
+        static_cast<std::ofstream*>(out)->close();
+    }
+}
+
+/*!
+ * Analysis routine to exit the application.
+ * The first thread to get here exits through PIN_ExitApplication(), which flushes
+ * the trace buffers of all threads before Fini() prints the results; any other
+ * thread crossing the window end meanwhile just carries on until it is stopped.
+ */
+VOID MyExitRoutine()
+{
+    if (__sync_bool_compare_and_swap(&windowDone, 0, 1))
+    {
+        PIN_ExitApplication(0);
+    }
+}
+
+// Then routine of CountBbl() in the guarded and detailed phases: publish a batch and exit at the window end
+VOID PublishCountAndCheckEnd(THREAD_DATA* td)
+{
+    if (PublishIcount(td) >= fast_forward_count + WINDOW_LENGTH) {
+        MyExitRoutine();
+    }
+}
+
+/*!
+ * Apply the precomputed counter increments of a basic block or predicated instruction.
+ * @param[in]   td       counter block of the running thread
+ * @param[in]   delta    increments built by AddToCountDelta() at instrumentation time
+ */
+VOID ApplyCountDelta(THREAD_DATA* td, COUNT_DELTA* delta)
+{
+    for (UINT32 i = 0; i < NUM_INS_TYPES; i++) {
+        td->counts[i] += delta->counts[i];
+    }
+    td->cycles += delta->cycles;
+    td->execPages[delta->id >> EXEC_PAGE_BITS][delta->id & ((1 << EXEC_PAGE_BITS) - 1)]++;
+}
+
+/* ===================================================================== */
+// Instrumentation callbacks
+/* ===================================================================== */
+// Whether analysis calls need a window check, see PHASE
+static inline BOOL WindowGuarded()
+{
+    return phase == PHASE_GUARDED || phase == PHASE_ROI;
+}
+
+/*!
+ * Insert the window check of the guarded phases with one of the
+ * INS_InsertIfCall() family: InRoi() in PHASE_ROI, FastForward() otherwise.
+ */
+template <typename T>
+static VOID InsertWindowIf(VOID (*insertIf)(T, IPOINT, AFUNPTR, ...), T obj)
+{
+    if (phase == PHASE_ROI) {
+        insertIf(obj, IPOINT_BEFORE, (AFUNPTR) InRoi, IARG_REG_VALUE, tlsReg, IARG_END);
+    } else {
+        insertIf(obj, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
+    }
+}
+
+/*!
+ * Insert a predicated analysis call that must only run inside the measured window.
+ * In the guarded phases it is preceded by a window check; in PHASE_DETAILED
+ * all executed code is inside the window and the call is inserted unguarded.
+ * The call only fires for instructions with a true predicate, and so does the
+ * FillBuffer variant, which appends a record to the memory access buffer.
+ * The Bbl variant is an unpredicated call at the head of a basic block.
+ */
+template <typename... ARGS>
+static VOID InsertWindowPredicatedCall(INS ins, AFUNPTR fn, ARGS... args)
+{
+    if (WindowGuarded()) {
+        InsertWindowIf(INS_InsertIfCall, ins);
+        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, fn, args...);
+    } else {
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, fn, args...);
+    }
+}
+
+template <typename... ARGS>
+static VOID InsertWindowFillBuffer(INS ins, ARGS... args)
+{
+    if (WindowGuarded()) {
+        InsertWindowIf(INS_InsertIfPredicatedCall, ins);
+        INS_InsertFillBufferThen(ins, IPOINT_BEFORE, memBuffer, args...);
+    } else {
+        INS_InsertFillBufferPredicated(ins, IPOINT_BEFORE, memBuffer, args...);
+    }
+}
+
+template <typename... ARGS>
+static VOID InsertBblWindowCall(BBL bbl, AFUNPTR fn, ARGS... args)
+{
+    if (WindowGuarded()) {
+        InsertWindowIf(BBL_InsertIfCall, bbl);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, fn, args...);
+    } else {
+        BBL_InsertCall(bbl, IPOINT_BEFORE, fn, args...);
+    }
+}
+
+/*!
+ * Recognize an SSC mark and get its tag from the preceding "mov ebx, <tag>".
+ */
+static BOOL IsSscMark(INS ins, UINT32* tag)
+{
+    UINT8 bytes[sizeof(SSC_MARK_BYTES)];
+    if (INS_Size(ins) != sizeof(SSC_MARK_BYTES) ||
+        PIN_SafeCopy(bytes, (VOID*)INS_Address(ins), sizeof(bytes)) != sizeof(bytes) ||
+        memcmp(bytes, SSC_MARK_BYTES, sizeof(bytes)))
+    {
+        return FALSE;
+    }
+    INS prev = INS_Prev(ins);
+    if (!INS_Valid(prev) || INS_Opcode(prev) != XED_ICLASS_MOV || !INS_OperandIsReg(prev, 0) ||
+        REG_FullRegName(INS_OperandReg(prev, 0)) != REG_GBX || !INS_OperandIsImmediate(prev, 1))
+    {
+        return FALSE;
+    }
+    *tag = (UINT32)INS_OperandImmediate(prev, 1);
+    return TRUE;
 }
 
-ADDRINT Terminate(void)
+/*!
+ * Expand categoryTable into the dense categorySlots lookup.
+ */
+static VOID InitCategorySlots()
 {
-        return (icount >= fast_forward_count + 1000000000);
+    CATEGORY_SLOT rest = { TYPE_OTHER, INS_LATENCY };
+    std::fill(categorySlots, categorySlots + XED_CATEGORY_LAST, rest);
+    for (size_t i = 0; i < sizeof(categoryTable) / sizeof(categoryTable[0]); i++) {
+        categorySlots[categoryTable[i].category] = categoryTable[i].slot;
+    }
 }
 
-// Analysis routine to check fast-forward condition
-ADDRINT FastForward(void) {
-	return (icount >= fast_forward_count && icount);
+/*!
+ * Classify an instruction into one of the fifteen type A categories.
+ * Every instruction has exactly one XED category, so a table lookup gives the
+ * same result as testing the categories in the order prescribed by the assignment.
+ */
+static CATEGORY_SLOT CategorizeIns(INS ins)
+{
+    CATEGORY_SLOT slot = categorySlots[INS_Category(ins)];
+    if (slot.type == TYPE_INDIRECT_CALL && INS_IsDirectCall(ins))
+        slot.type = TYPE_DIRECT_CALL;
+    return slot;
 }
 
 /*!
- * Record instruction footprint.
- * This analysis routine is called for every instruction (all instructions are counted regardless of predicate).
- * It calculates which 32-byte chunks this instruction touches and adds them to a global set.
+ * Allocate a COUNT_DELTA with a fresh execution counter id. When the id starts a
+ * new page of counters, the page is allocated for every existing thread before
+ * any code using the delta can run (instrumentation and thread start callbacks
+ * are serialized by Pin).
  */
-inline VOID RecordInsFootprint(ADDRINT addr, UINT32 size)
+static COUNT_DELTA* NewCountDelta()
 {
-    ADDRINT start = addr;
-    ADDRINT end = addr + size - 1;
-    // Compute the starting chunk (aligned to 32 bytes)
-    ADDRINT chunk = start - (start % 32);
-    // If the instruction spans more than one chunk then record all touched chunks.
-    while (chunk <= end)
-    {
-        insChunks.insert(chunk);
-        chunk += 32;
+    COUNT_DELTA* delta = new COUNT_DELTA();
+    delta->id = numCountDeltas++;
+    ASSERTX((delta->id >> EXEC_PAGE_BITS) < MAX_EXEC_PAGES);
+    if ((delta->id & ((1 << EXEC_PAGE_BITS) - 1)) == 0) {
+        for (size_t t = 0; t < threadData.size(); t++) {
+            threadData[t]->execPages[delta->id >> EXEC_PAGE_BITS] = new UINT64[1 << EXEC_PAGE_BITS]();
+        }
     }
+    return delta;
 }
 
 /*!
- * Record data footprint.
- * This analysis routine is called for each memory access (load or store) with true predicate.
- * It calculates which 32-byte chunks the memory access touches.
+ * Add the Part A/B contribution of one execution of an instruction to a delta:
+ * one load/store micro-op per 4 bytes of each memory operand (type B) plus the
+ * type A operation itself.
  */
-inline VOID RecordDataFootprint(ADDRINT ea, UINT32 size)
+static VOID AddToCountDelta(INS ins, COUNT_DELTA* delta)
 {
-    ADDRINT start = ea;
-    ADDRINT end = ea + size - 1;
-    // Compute the starting chunk (aligned to 32 bytes)
-    ADDRINT chunk = start - (start % 32);
-    while (chunk <= end)
-    {
-        dataChunks.insert(chunk);
-        chunk += 32;
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        UINT32 val = (INS_MemoryOperandSize(ins, memOp) + 3) / 4;
+        if (INS_MemoryOperandIsRead(ins, memOp)) {
+            delta->counts[TYPE_LOAD] += val;
+            delta->cycles += val * MEM_OP_LATENCY;
+        }
+        if (INS_MemoryOperandIsWritten(ins, memOp)) {
+            delta->counts[TYPE_STORE] += val;
+            delta->cycles += val * MEM_OP_LATENCY;
+        }
     }
+
+    CATEGORY_SLOT slot = CategorizeIns(ins);
+    delta->counts[slot.type]++;
+    delta->cycles += slot.latency;
 }
 
-// Analysis routine to exit the application
-VOID MyExitRoutine()
+// Part D properties of a static instruction, without its deltas
+static INS_RECORD StaticInsRecord(INS ins)
 {
-    UINT64 total_executed = g_loads + g_stores + g_nops + g_direct_calls + 
-                           g_indirect_calls + g_returns + g_unconditional_branches + 
-                           g_conditional_branches + g_logical_operations + 
-                           g_rotate_shift + g_flag_operations + g_vector_instructions + 
-                           g_conditional_moves + g_mmx_sse + g_system_calls + 
-                           g_floating_point + g_others;
-
-    *out << "===============================================\n";
-    *out << "Instruction Type Results: \n";
-    *out << "Loads: " << g_loads << " (" << (float)g_loads/total_executed << ")\n";
-    *out << "Stores: " << g_stores << " (" << (float)g_stores/total_executed << ")\n";
-    *out << "NOPs: " << g_nops << " (" << (float)g_nops/total_executed << ")\n";
-    *out << "Direct calls: " << g_direct_calls << " (" << (float)g_direct_calls/total_executed << ")\n";
-    *out << "Indirect calls: " << g_indirect_calls << " (" << (float)g_indirect_calls/total_executed << ")\n";
-    *out << "Returns: " << g_returns << " (" << (float)g_returns/total_executed << ")\n";
-    *out << "Unconditional branches: " << g_unconditional_branches << " (" << (float)g_unconditional_branches/total_executed << ")\n";
-    *out << "Conditional branches: " << g_conditional_branches << " (" << (float)g_conditional_branches/total_executed << ")\n";
-    *out << "Logical operations: " << g_logical_operations << " (" << (float)g_logical_operations/total_executed << ")\n";
-    *out << "Rotate and Shift: " << g_rotate_shift << " (" << (float)g_rotate_shift/total_executed << ")\n";
-    *out << "Flag operations: " << g_flag_operations << " (" << (float)g_flag_operations/total_executed << ")\n";
-    *out << "Vector instructions: " << g_vector_instructions << " (" << (float)g_vector_instructions/total_executed << ")\n";
-    *out << "Conditional moves: " << g_conditional_moves << " (" << (float)g_conditional_moves/total_executed << ")\n";
-    *out << "MMX and SSE instructions: " << g_mmx_sse << " (" << (float)g_mmx_sse/total_executed << ")\n";
-    *out << "System calls: " << g_system_calls << " (" << (float)g_system_calls/total_executed << ")\n";
-    *out << "Floating point instructions: " << g_floating_point << " (" << (float)g_floating_point/total_executed << ")\n";
-    *out << "The rest: " << g_others << " (" << (float)g_others/total_executed << ")\n";
-    *out << "CPI: " << (float)cycle_latency/total_executed << "\n\n";
-
-    *out << "Instruction Size Results: \n";
-    for(int i = 0; i <= 19; i++) {
-        *out << i << " : " << (insLengthDist.count(i) ? insLengthDist[i] : 0) << "\n";
-    }
-    *out << "\n";
-
-    *out << "Memory Instruction Operand Results: \n";
-    for(int i = 0; i <= 4; i++) {
-        *out << i << " : " << (memOpDist.count(i) ? memOpDist[i] : 0) << "\n";
+    INS_RECORD rec;
+    rec.block = NULL;
+    rec.predicated = NULL;
+    rec.pc = INS_Address(ins);
+    rec.size = INS_Size(ins);
+    rec.iclass = INS_Opcode(ins);
+    rec.extension = INS_Extension(ins);
+    rec.operands = INS_OperandCount(ins);
+    rec.regReads = INS_MaxNumRRegs(ins);
+    rec.regWrites = INS_MaxNumWRegs(ins);
+    rec.memOperands = INS_MemoryOperandCount(ins);
+    rec.memReads = 0;
+    rec.memWrites = 0;
+    rec.memBytes = 0;
+    rec.hasImm = FALSE;
+    rec.minImm = INT32_MAX;
+    rec.maxImm = INT32_MIN;
+    rec.hasDisp = FALSE;
+    rec.minDisp = std::numeric_limits<ADDRDELTA>::max();
+    rec.maxDisp = std::numeric_limits<ADDRDELTA>::min();
+
+    for (UINT32 memOp = 0; memOp < rec.memOperands; memOp++) {
+        rec.memBytes += INS_MemoryOperandSize(ins, memOp);
+        if (INS_MemoryOperandIsRead(ins, memOp)) rec.memReads++;
+        if (INS_MemoryOperandIsWritten(ins, memOp)) rec.memWrites++;
+
+        // 10. Displacement of every memory operand
+        ADDRDELTA disp = INS_OperandMemoryDisplacement(ins, memOp);
+        rec.hasDisp = TRUE;
+        rec.maxDisp = std::max(rec.maxDisp, disp);
+        rec.minDisp = std::min(rec.minDisp, disp);
     }
-    *out << "\n";
 
-    *out << "Memory Instruction Read Operand Results: \n";
-    for(int i = 0; i <= 4; i++) {
-        *out << i << " : " << (memReadDist.count(i) ? memReadDist[i] : 0) << "\n";
+    // 9. Immediate operands, recovered as signed 32-bit values
+    for (UINT32 op = 0; op < rec.operands; op++) {
+        if (INS_OperandIsImmediate(ins, op)) {
+            INT32 imm = (INT32)INS_OperandImmediate(ins, op);
+            rec.hasImm = TRUE;
+            rec.maxImm = std::max(rec.maxImm, imm);
+            rec.minImm = std::min(rec.minImm, imm);
+        }
     }
-    *out << "\n";
+    return rec;
+}
 
-    *out << "Memory Instruction Write Operand Results: \n";
-    for(int i = 0; i <= 4; i++) {
-        *out << i << " : " << (memWriteDist.count(i) ? memWriteDist[i] : 0) << "\n";
-    }
-    *out << "\n";
+/*!
+ * Capture the Part D properties of a static instruction.
+ * @param[in]   block       delta applied on every execution of the instruction's basic block
+ * @param[in]   predicated  delta applied when the instruction executes with a true predicate
+ */
+static VOID RecordStaticIns(INS ins, COUNT_DELTA* block, COUNT_DELTA* predicated)
+{
+    INS_RECORD rec = StaticInsRecord(ins);
+    rec.block = block;
+    rec.predicated = predicated;
+    insRecords.push_back(rec);
+}
 
-    *out << "Instruction Operand Results: \n";
-    for(int i = 0; i <= 9; i++) {
-        *out << i << " : " << (operandCountDist.count(i) ? operandCountDist[i] : 0) << "\n";
-    }
-    *out << "\n";
+// Saturate a count for a TRACE_INS field
+static UINT8 TraceCount(UINT32 count)
+{
+    return std::min<UINT32>(count, UINT8_MAX);
+}
 
-    *out << "Instruction Register Read Operand Results: \n";
-    for(int i = 0; i <= 9; i++) {
-        *out << i << " : " << (regReadDist.count(i) ? regReadDist[i] : 0) << "\n";
+/*!
+ * Add the instructions of a basic block from first to its end, with their
+ * Part D properties, to the trace dictionary.
+ * @return the dictionary id of the new block
+ */
+static UINT32 AddTraceBlock(INS first)
+{
+    TRACE_BLOCK block = { INS_Address(first), 0, (UINT32)traceIns.size() };
+    for (INS ins = first; INS_Valid(ins); ins = INS_Next(ins)) {
+        INS_RECORD props = StaticInsRecord(ins);
+        TRACE_INS rec = TRACE_INS();
+        rec.size = props.size;
+        rec.type = CategorizeIns(ins).type;
+        rec.flags = (INS_IsPredicated(ins) ? TRACE_INS_PREDICATED : 0) |
+                    (props.hasImm ? TRACE_INS_IMM : 0) | (props.hasDisp ? TRACE_INS_DISP : 0);
+        rec.operands = TraceCount(props.operands);
+        rec.regReads = TraceCount(props.regReads);
+        rec.regWrites = TraceCount(props.regWrites);
+        rec.memOperands = TraceCount(props.memOperands);
+        rec.memReads = TraceCount(props.memReads);
+        rec.memWrites = TraceCount(props.memWrites);
+        rec.memBytes = props.memBytes;
+        rec.minImm = props.minImm;
+        rec.maxImm = props.maxImm;
+        rec.minDisp = props.minDisp;
+        rec.maxDisp = props.maxDisp;
+        traceIns.push_back(rec);
+        block.numIns++;
     }
-    *out << "\n";
+    traceBlocks.push_back(block);
+    return traceBlocks.size() - 1;
+}
 
-    *out << "Instruction Register Write Operand Results: \n";
-    for(int i = 0; i <= 9; i++) {
-        *out << i << " : " << (regWriteDist.count(i) ? regWriteDist[i] : 0) << "\n";
+/*!
+ * Add a block with the Part D properties of its instructions to the trace
+ * dictionary and record its executions in the memory access buffer, ahead of
+ * the data accesses of its first instruction.
+ */
+static VOID InsertBlockRecord(BBL bbl)
+{
+    UINT32 id = AddTraceBlock(BBL_InsHead(bbl));
+    INS head = BBL_InsHead(bbl);
+    if (WindowGuarded()) {
+        if (phase == PHASE_GUARDED) {
+            INS_InsertIfCall(head, IPOINT_BEFORE, (AFUNPTR) GuardedBlockRecordDue, IARG_REG_VALUE, tlsReg, IARG_END);
+        } else {
+            InsertWindowIf(INS_InsertIfCall, head);
+        }
+        INS_InsertFillBufferThen(head, IPOINT_BEFORE, memBuffer,
+                                 IARG_INST_PTR, offsetof(MEM_REF, pc),
+                                 IARG_ADDRINT, (ADDRINT)id, offsetof(MEM_REF, ea),
+                                 IARG_UINT32, MEM_REF_BLOCK, offsetof(MEM_REF, flags),
+                                 IARG_END);
+    } else {
+        INS_InsertFillBuffer(head, IPOINT_BEFORE, memBuffer,
+                             IARG_INST_PTR, offsetof(MEM_REF, pc),
+                             IARG_ADDRINT, (ADDRINT)id, offsetof(MEM_REF, ea),
+                             IARG_UINT32, MEM_REF_BLOCK, offsetof(MEM_REF, flags),
+                             IARG_END);
     }
-    *out << "\n";
+}
 
-    *out << "Instruction Blocks Accesses : " << insChunks.size() << "\n";
-    *out << "Memory Blocks Accesses : " << dataChunks.size() << "\n";
-    *out << "Maximum number of bytes touched by an instruction : " << maxMemBytes << "\n";
-    *out << "Average number of bytes touched by an instruction : " << (memInstCount ? (double)totalMemBytes/memInstCount : 0) << "\n";
-    *out << "Maximum value of immediate : " << maxImm << "\n";
-    *out << "Minimum value of immediate : " << minImm << "\n";
-    *out << "Maximum value of displacement used in memory addressing : " << maxDisp << "\n";
-    *out << "Minimum value of displacement used in memory addressing : " << minDisp << "\n";
-    *out << "===============================================\n";
+/*!
+ * Record the rest of a basic block, from first on, as a block of its own when
+ * the If call due, inserted before ins, fires. It is used where the window opens
+ * in the middle of a block whose block record was skipped at its head, so that
+ * the data accesses that follow still come after a block record.
+ */
+static VOID InsertPartialBlockRecord(INS ins, INS first, AFUNPTR due)
+{
+    UINT32 id = AddTraceBlock(first);
+    INS_InsertIfCall(ins, IPOINT_BEFORE, due, IARG_REG_VALUE, tlsReg, IARG_END);
+    INS_InsertFillBufferThen(ins, IPOINT_BEFORE, memBuffer,
+                             IARG_ADDRINT, INS_Address(first), offsetof(MEM_REF, pc),
+                             IARG_ADDRINT, (ADDRINT)id, offsetof(MEM_REF, ea),
+                             IARG_UINT32, MEM_REF_BLOCK, offsetof(MEM_REF, flags),
+                             IARG_END);
+}
 
-    // Final flush before closing
-    if (out != &cerr)
-    {
-        *out << std::flush;  // One final flush before closing
-        static_cast<std::ofstream*>(out)->close();
+/*!
+ * Write the last chunk of every thread, the block dictionary, the chunk index
+ * and the footer of the trace file, and close it.
+ */
+static VOID FinishTrace()
+{
+    for (size_t t = 0; t < threadData.size(); t++) {
+        threadData[t]->trace->Flush();
     }
-    exit(0);
+    TRACE_FILE_FOOTER footer = TRACE_FILE_FOOTER();
+    footer.numBlocks = traceBlocks.size();
+    footer.numIns = traceIns.size();
+    footer.numChunks = traceIndex.size();
+    memcpy(footer.magic, "HW1T", 4);
+    footer.version = TRACE_FILE_VERSION;
+
+    footer.blocksOffset = traceOut->tellp();
+    traceOut->write(reinterpret_cast<const char*>(traceBlocks.data()), traceBlocks.size() * sizeof(TRACE_BLOCK));
+    footer.insOffset = traceOut->tellp();
+    traceOut->write(reinterpret_cast<const char*>(traceIns.data()), traceIns.size() * sizeof(TRACE_INS));
+    footer.indexOffset = traceOut->tellp();
+    traceOut->write(reinterpret_cast<const char*>(traceIndex.data()), traceIndex.size() * sizeof(TRACE_INDEX_ENTRY));
+    traceOut->write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    traceOut->close();
 }
 
-// Predicated analysis routine
-void MyPredicatedAnalysis() {
-	// analysis code
+// Whether ins writes reg or any of its sub-registers, e.g. eax for rax
+static BOOL WritesFullReg(INS ins, REG fullReg)
+{
+    for (UINT32 i = 0; i < INS_MaxNumWRegs(ins); i++) {
+        if (REG_FullRegName(INS_RegW(ins, i)) == fullReg) return TRUE;
+    }
+    return FALSE;
 }
 
-// Make all increment functions inline
-inline void inc_load(UINT32 val){
-    g_loads += val;
-    cycle_latency += val*70;
-}
-inline void inc_store(UINT32 val){
-    g_stores += val;
-    cycle_latency += val*70;
-}
-inline void inc_nop(){
-    g_nops++;
-    cycle_latency++;
-}
-inline void inc_direct_call(){
-    g_direct_calls++;
-    cycle_latency++;
-}
-inline void inc_indirect_call(){
-    g_indirect_calls++;
-    cycle_latency++;
-}
-inline void inc_return(){
-    g_returns++;
-    cycle_latency++;
-}
-inline void inc_unconditional_branch(){
-    g_unconditional_branches++;
-    cycle_latency++;
-}
-inline void inc_conditional_branch(){
-    g_conditional_branches++;
-    cycle_latency++;
-}
-inline void inc_logical_operation(){
-    g_logical_operations++;
-    cycle_latency++;
-}
-inline void inc_rotate_shift(){
-    g_rotate_shift++;
-    cycle_latency++;
-}
-inline void inc_flag_operation(){
-    g_flag_operations++;
-    cycle_latency++;
-}
-inline void inc_vector_instruction(){
-    g_vector_instructions++;
-    cycle_latency++;
-}
-inline void inc_conditional_move(){
-    g_conditional_moves++;
-    cycle_latency++;
-}
-inline void inc_mmx_sse(){
-    g_mmx_sse++;
-    cycle_latency++;
-}
-inline void inc_system_call(){
-    g_system_calls++;
-    cycle_latency++;
-}
-inline void inc_floating_point(){
-    g_floating_point++;
-    cycle_latency++;
-}
-inline void inc_other(){
-    g_others++;
-    cycle_latency++;
+// Whether an earlier instruction of the basic block, or else ins itself, last wrote reg with a load
+static BOOL LoadedByLoad(INS ins, REG reg)
+{
+    if (!REG_valid(reg)) return FALSE;
+    reg = REG_FullRegName(reg);
+    for (INS prev = INS_Prev(ins); INS_Valid(prev); prev = INS_Prev(prev)) {
+        if (WritesFullReg(prev, reg)) return INS_IsMemoryRead(prev);
+    }
+    return WritesFullReg(ins, reg);
 }
 
-// Make analysis functions inline
-inline VOID UpdateImmediateStats(ADDRINT imm) {
-    INT32 signedImm = (INT32)imm;
-    maxImm = std::max(maxImm, signedImm);
-    minImm = std::min(minImm, signedImm);
+/*!
+ * Static pointer chasing test of a load: its base or index register holds a
+ * value loaded from memory, as in p = p->next. The register may have been
+ * loaded earlier in the basic block, or by the load itself in a previous
+ * iteration of a loop.
+ */
+static BOOL IsPointerChase(INS ins)
+{
+    return INS_IsMemoryRead(ins) &&
+           (LoadedByLoad(ins, INS_MemoryBaseReg(ins)) || LoadedByLoad(ins, INS_MemoryIndexReg(ins)));
 }
 
-inline VOID UpdateDisplacementStats(ADDRINT disp) {
-    ADDRDELTA signedDisp = (ADDRDELTA)disp;
-    maxDisp = std::max(maxDisp, signedDisp);
-    minDisp = std::min(minDisp, signedDisp);
+/*!
+ * Record a MEM_REF for one memory operand in the memory access buffer. The
+ * window field is only filled in when the working set is measured.
+ * @param[in]   sizeArg     IARG_MEMORYREAD_SIZE or IARG_MEMORYWRITE_SIZE
+ */
+static VOID InsertMemRef(INS ins, UINT32 memOp, IARG_TYPE sizeArg, UINT32 flags)
+{
+    if (wsLength) {
+        InsertWindowFillBuffer(ins,
+                               IARG_INST_PTR, offsetof(MEM_REF, pc),
+                               IARG_MEMORYOP_EA, memOp, offsetof(MEM_REF, ea),
+                               sizeArg, offsetof(MEM_REF, size),
+                               IARG_UINT32, flags, offsetof(MEM_REF, flags),
+                               IARG_REG_VALUE, epochReg, offsetof(MEM_REF, window),
+                               IARG_END);
+    } else {
+        InsertWindowFillBuffer(ins,
+                               IARG_INST_PTR, offsetof(MEM_REF, pc),
+                               IARG_MEMORYOP_EA, memOp, offsetof(MEM_REF, ea),
+                               sizeArg, offsetof(MEM_REF, size),
+                               IARG_UINT32, flags, offsetof(MEM_REF, flags),
+                               IARG_END);
+    }
 }
 
-inline VOID UpdateMemOpDist(UINT32 reads, UINT32 writes) {
-    memOpDist[reads + writes]++;
+// Register a dataflow model tracks: the instruction pointer is left out, branches being predicted perfectly
+static BOOL DataflowReg(REG reg)
+{
+    return REG_valid(reg) && reg != REG_INST_PTR;
 }
 
-inline VOID UpdateInstructionStats(UINT32 size, UINT32 opCount, UINT32 readRegs, UINT32 writeRegs) {
-    insLengthDist[size]++;
-    operandCountDist[opCount]++;
-    regReadDist[readRegs]++;
-    regWriteDist[writeRegs]++;
+/*!
+ * Describe an instruction for the dataflow limit study and the dependence
+ * distances. Memory operands beyond the first DATAFLOW_MEM_OPERANDS (gathers,
+ * scatters) are left out.
+ */
+static DATAFLOW_INS* NewDataflowIns(INS ins)
+{
+    DATAFLOW_INS* desc = new DATAFLOW_INS();
+    for (UINT32 i = 0; i < INS_MaxNumRRegs(ins); i++) {
+        REG reg = REG_FullRegName(INS_RegR(ins, i));
+        if (DataflowReg(reg) && std::find(desc->reads.begin(), desc->reads.end(), reg) == desc->reads.end())
+            desc->reads.push_back(reg);
+    }
+    for (UINT32 i = 0; i < INS_MaxNumWRegs(ins); i++) {
+        REG reg = REG_FullRegName(INS_RegW(ins, i));
+        if (DataflowReg(reg) && std::find(desc->writes.begin(), desc->writes.end(), reg) == desc->writes.end())
+            desc->writes.push_back(reg);
+    }
+    desc->readsMemory = INS_IsMemoryRead(ins);
+    desc->latency = CategorizeIns(ins).latency;
+    desc->numMemOps = std::min(INS_MemoryOperandCount(ins), DATAFLOW_MEM_OPERANDS);
+    for (UINT32 memOp = 0; memOp < desc->numMemOps; memOp++) {
+        desc->memSize[memOp] = INS_MemoryOperandSize(ins, memOp);
+        desc->memRead[memOp] = INS_MemoryOperandIsRead(ins, memOp);
+        desc->memWritten[memOp] = INS_MemoryOperandIsWritten(ins, memOp);
+    }
+    return desc;
 }
 
-inline VOID UpdateMemoryAnalysis(UINT32 memReads, UINT32 memWrites, UINT32 totalBytes) {
-    memReadDist[memReads]++;
-    memWriteDist[memWrites]++;
-    maxMemBytes = std::max(maxMemBytes, (UINT64)totalBytes);
-    totalMemBytes += totalBytes;
-    memInstCount++;
+// Insert the dataflow limit study call of an instruction, passing the addresses of its memory operands
+static VOID InsertDataflowCall(INS ins, const DATAFLOW_INS* desc)
+{
+    if (desc->numMemOps == 2) {
+        InsertWindowPredicatedCall(ins, (AFUNPTR) DataflowIns, IARG_REG_VALUE, tlsReg, IARG_PTR, desc,
+                                   IARG_MEMORYOP_EA, 0, IARG_MEMORYOP_EA, 1, IARG_END);
+    } else if (desc->numMemOps == 1) {
+        InsertWindowPredicatedCall(ins, (AFUNPTR) DataflowIns, IARG_REG_VALUE, tlsReg, IARG_PTR, desc,
+                                   IARG_MEMORYOP_EA, 0, IARG_ADDRINT, 0, IARG_END);
+    } else {
+        InsertWindowPredicatedCall(ins, (AFUNPTR) DataflowIns, IARG_REG_VALUE, tlsReg, IARG_PTR, desc,
+                                   IARG_ADDRINT, 0, IARG_ADDRINT, 0, IARG_END);
+    }
 }
 
-/* ===================================================================== */
-// Instrumentation callbacks
-/* ===================================================================== */
+/*!
+ * Per-instruction instrumentation for the footprint (Part C): data accesses go to
+ * the memory access buffer. Instruction counting, the instruction footprint,
+ * Part A/B and Part D are handled per basic block in Trace().
+ */
 VOID Instruction(INS ins, VOID *v)
 {
-    // Instrumentation routine
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) Terminate, IARG_END);
+    UINT32 chase = (strideAnalysis && IsPointerChase(ins)) ? MEM_REF_CHASE : 0;
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+    if (traceOut && phase == PHASE_GUARDED && INS_Valid(INS_Prev(ins)) && (memOperands || INS_IsPredicated(ins))) {
+        // Another thread may publish the window start while this one is inside the block
+        InsertPartialBlockRecord(ins, ins, (AFUNPTR) GuardedPartialBlockDue);
+    }
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        if (INS_MemoryOperandIsRead(ins, memOp)) {
+            InsertMemRef(ins, memOp, IARG_MEMORYREAD_SIZE, chase);
+        }
+        if (INS_MemoryOperandIsWritten(ins, memOp)) {
+            InsertMemRef(ins, memOp, IARG_MEMORYWRITE_SIZE, MEM_REF_WRITE);
+        }
+    }
+    if (traceOut && memOperands == 0 && INS_IsPredicated(ins)) {
+        // The trace cannot tell from data accesses whether the instruction executed
+        InsertWindowFillBuffer(ins,
+                               IARG_INST_PTR, offsetof(MEM_REF, pc),
+                               IARG_UINT32, MEM_REF_EXEC, offsetof(MEM_REF, flags),
+                               IARG_END);
+    }
 
-    // MyExitRoutine() is called only when the last call returns a non-zero value.
-    INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR) MyExitRoutine, IARG_END);
+    if (!ilpWindows.empty() || dependenceAnalysis) {
+        DATAFLOW_INS* desc = NewDataflowIns(ins);
+        if (!ilpWindows.empty()) {
+            InsertDataflowCall(ins, desc);
+        }
+        if (dependenceAnalysis) {
+            InsertWindowPredicatedCall(ins, (AFUNPTR) DependenceIns, IARG_REG_VALUE, tlsReg, IARG_PTR, desc, IARG_END);
+        }
+    }
+}
 
-    // FastForward() is called for every instruction executed
-    // INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
+/*!
+ * Instrument every basic block of the trace.
+ * The instruction count, the Part A/B counters and the instruction footprint are
+ * handled with one analysis call each per basic block; the exit check only runs when CountBbl() has a batch
+ * of instructions to publish. The counter increments of all unpredicated
+ * instructions are summed into a COUNT_DELTA here and applied in one go at run time.
+ * Predicated instructions (CMOVcc, REP string ops, ...) may not execute, so they keep
+ * their own delta applied with a predicated call. Each instruction's Part D properties
+ * are recorded along with the deltas that count its executions. The per-instruction
+ * Part C instrumentation is inserted afterwards so that it observes the updated icount.
+ * In PHASE_FAST_FORWARD only the instruction count and the window-start check
+ * are inserted, and in PHASE_DETAILED the block-level window-end check is the
+ * only guard left.
+ * This function is called every time a new trace is encountered.
+ * @param[in]   trace    trace to be instrumented
+ * @param[in]   v        value specified by the tool in the TRACE_AddInstrumentFunction
+ *                       function call
+ */
+VOID Trace(TRACE trace, VOID* v)
+{
+    // Visit every basic block in the trace
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        // Insert a call to CountBbl() before every basic bloc, passing the number of instructions.
+        // StartWindow() checks the fast-forward count whenever the thread publishes a batch.
+        if (phase == PHASE_FAST_FORWARD) {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) CountBbl, IARG_REG_VALUE, tlsReg,
+                             IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) StartWindow, IARG_REG_VALUE, tlsReg,
+                               IARG_UINT32, BBL_NumIns(bbl), IARG_CONTEXT, IARG_END);
+            continue;
+        }
 
-    // // MyPredicatedAnalysis() is called only when the last FastForward() returns a non-zero value.
-    // INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) MyPredicatedAnalysis, IARG_END);
+        // PublishCountAndCheckEnd() calls MyExitRoutine() once the window end has been crossed.
+        // A region of interest or a sampled run is measured until the application exits,
+        // so its instructions need not be published.
+        if (phase == PHASE_ROI || phase == PHASE_SAMPLED) {
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) CountBbl, IARG_REG_VALUE, tlsReg,
+                           IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        } else {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) CountBbl, IARG_REG_VALUE, tlsReg,
+                             IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) PublishCountAndCheckEnd, IARG_REG_VALUE, tlsReg, IARG_END);
+        }
 
-    // Instrumentation routine
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) InsCount, IARG_END);
+        // StartSample() switches the thread to the detailed version once the gap is over.
+        if (phase == PHASE_SAMPLED && TRACE_Version(trace) == VERSION_FAST) {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) SampleGapDone, IARG_REG_VALUE, tlsReg,
+                             IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) StartSample, IARG_REG_VALUE, tlsReg,
+                               IARG_UINT32, BBL_NumIns(bbl), IARG_RETURN_REGS, versionReg, IARG_END);
+            INS_InsertVersionCase(BBL_InsHead(bbl), versionReg, VERSION_DETAILED, VERSION_DETAILED, IARG_END);
+            continue;
+        }
 
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-    INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordInsFootprint,IARG_INST_PTR,IARG_UINT32, INS_Size(ins),IARG_END);
+        // EndSample() switches the thread back to the fast version once the sample is complete.
+        if (phase == PHASE_SAMPLED) {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) SampleDone, IARG_REG_VALUE, tlsReg,
+                             IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) EndSample, IARG_REG_VALUE, tlsReg,
+                               IARG_UINT32, BBL_NumIns(bbl), IARG_RETURN_REGS, versionReg, IARG_END);
+            INS_InsertVersionCase(BBL_InsHead(bbl), versionReg, VERSION_FAST, VERSION_FAST, IARG_END);
+        }
 
-    UINT32 memOperands = INS_MemoryOperandCount(ins);
-    UINT32 memReads = 0;
-    UINT32 memWrites = 0;
-    if(memOperands > 0){
-        // type B instructions
-
-        UINT32 totalMemBytes = 0;
-        for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
-            UINT32  op_size = INS_MemoryOperandSize(ins,memOp);
-            totalMemBytes += op_size;
-            UINT32 val = (op_size+3)/4;
-            if (INS_MemoryOperandIsRead(ins, memOp)) {
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-                INS_InsertThenPredicatedCall(ins,IPOINT_BEFORE,(AFUNPTR) inc_load,IARG_UINT32, val, IARG_END);
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-                INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordDataFootprint,
-                                        IARG_MEMORYOP_EA, memOp,
-                                        IARG_MEMORYREAD_SIZE,
-                                        IARG_END);
-                memReads++;
+        COUNT_DELTA* bblDelta = NewCountDelta();
+        BLOCK_RECORD block = { BBL_Address(bbl), BBL_NumIns(bbl), bblDelta };
+        blockRecords.push_back(block);
+        if (traceOut) {
+            InsertBlockRecord(bbl);
+        }
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            COUNT_DELTA* insDelta = bblDelta;
+            if (INS_IsPredicated(ins)) {
+                insDelta = NewCountDelta();
+                InsertWindowPredicatedCall(ins, (AFUNPTR) ApplyCountDelta, IARG_REG_VALUE, tlsReg,
+                                           IARG_PTR, insDelta, IARG_END);
             }
-            if (INS_MemoryOperandIsWritten(ins, memOp)) {
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-                INS_InsertThenPredicatedCall(ins,IPOINT_BEFORE,(AFUNPTR) inc_store,IARG_UINT32, val, IARG_END);
-                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-                INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordDataFootprint,
-                                        IARG_MEMORYOP_EA, memOp,
-                                        IARG_MEMORYWRITE_SIZE,
-                                        IARG_END);
-                memWrites++;
+            AddToCountDelta(ins, insDelta);
+            RecordStaticIns(ins, bblDelta, insDelta);
+        }
+        InsertBblWindowCall(bbl, (AFUNPTR) ApplyCountDelta, IARG_REG_VALUE, tlsReg, IARG_PTR, bblDelta, IARG_END);
+        InsertBblWindowCall(bbl, (AFUNPTR) RecordInsFootprint, IARG_REG_VALUE, tlsReg,
+                            IARG_ADDRINT, BBL_Address(bbl), IARG_UINT32, (UINT32)BBL_Size(bbl), IARG_END);
+
+        // EndInterval() is called only when the thread has completed an interval of the window
+        if (intervalLength) {
+            AFUNPTR due = (AFUNPTR)(WindowGuarded() ? GuardedIntervalDue : IntervalDue);
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, due, IARG_REG_VALUE, tlsReg, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) EndInterval, IARG_REG_VALUE, tlsReg, IARG_END);
+        }
+
+        // NextWorkingSetWindow() moves the thread to its next working set window
+        if (wsLength) {
+            AFUNPTR due = (AFUNPTR)(WindowGuarded() ? GuardedWorkingSetDue : WorkingSetDue);
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, due, IARG_REG_VALUE, tlsReg, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) NextWorkingSetWindow, IARG_REG_VALUE, tlsReg,
+                               IARG_RETURN_REGS, epochReg, IARG_END);
+        }
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            UINT32 tag;
+            if (KnobRoiMarkers && IsSscMark(ins, &tag) && (tag == ROI_START_MARK || tag == ROI_STOP_MARK)) {
+                if (traceOut && tag == ROI_START_MARK && INS_Valid(INS_Next(ins))) {
+                    // The block record was skipped at the head, outside the region
+                    InsertPartialBlockRecord(ins, INS_Next(ins), (AFUNPTR) EnterRoi);
+                } else {
+                    INS_InsertCall(ins, IPOINT_BEFORE, tag == ROI_START_MARK ? (AFUNPTR) EnterRoi : (AFUNPTR) ExitRoi,
+                                   IARG_REG_VALUE, tlsReg, IARG_CALL_ORDER, CALL_ORDER_FIRST, IARG_END);
+                }
             }
-            // 10
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)UpdateDisplacementStats,
-                                   IARG_ADDRINT, INS_OperandMemoryDisplacement(ins, memOp),
-                                   IARG_END);
-        }
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)UpdateMemoryAnalysis,
-                            IARG_UINT32, memReads,
-                            IARG_UINT32, memWrites,
-                            IARG_UINT32, totalMemBytes,
-                            IARG_END);
-    }
-
-
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-    INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)UpdateMemOpDist,
-                                IARG_UINT32, memReads,
-                                IARG_UINT32, memWrites,
-                                IARG_END);
-    // NOPs
-    if (INS_Category(ins) == XED_CATEGORY_NOP){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_nop, IARG_END);
-    }
-    // Direct calls
-    else if (INS_Category(ins) == XED_CATEGORY_CALL) {
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        if (INS_IsDirectCall(ins)) {
-            INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_direct_call, IARG_END);
-        } else {
-            INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_indirect_call, IARG_END);
-        }
-    }
-    // Returns
-    else if (INS_Category(ins) == XED_CATEGORY_RET){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_return, IARG_END);
-    }
-    // Unconditional branches
-    else if (INS_Category(ins) == XED_CATEGORY_UNCOND_BR){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_unconditional_branch, IARG_END);
-    }
-    // Conditional branches
-    else if (INS_Category(ins) == XED_CATEGORY_COND_BR){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_conditional_branch, IARG_END);
-    }
-    // Logical operations
-    else if (INS_Category(ins) == XED_CATEGORY_LOGICAL){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_logical_operation, IARG_END);
-    }
-    // Rotate and shift
-    else if (INS_Category(ins) == XED_CATEGORY_ROTATE || INS_Category(ins) == XED_CATEGORY_SHIFT){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_rotate_shift, IARG_END);
-    }
-    // Flag operations
-    else if (INS_Category(ins) == XED_CATEGORY_FLAGOP){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_flag_operation, IARG_END);
-    }
-    // Vector instructions
-    else if (INS_Category(ins) == XED_CATEGORY_AVX || 
-             INS_Category(ins) == XED_CATEGORY_AVX2 || 
-             INS_Category(ins) == XED_CATEGORY_AVX2GATHER || 
-             INS_Category(ins) == XED_CATEGORY_AVX512){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_vector_instruction, IARG_END);
-    }
-    // Conditional moves
-    else if (INS_Category(ins) == XED_CATEGORY_CMOV){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_conditional_move, IARG_END);
-    }
-    // MMX and SSE instructions
-    else if (INS_Category(ins) == XED_CATEGORY_MMX || INS_Category(ins) == XED_CATEGORY_SSE){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_mmx_sse, IARG_END);
-    }
-    // System calls
-    else if (INS_Category(ins) == XED_CATEGORY_SYSCALL){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_system_call, IARG_END);
-    }
-    // Floating-point
-    else if (INS_Category(ins) == XED_CATEGORY_X87_ALU){
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_floating_point, IARG_END);
-    }
-    // Others (whatever is left)
-    else {
-        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) FastForward, IARG_END);
-        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) inc_other, IARG_END);
-    }
-
-    // 1. Instruction length distribution (all instructions)
-    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-    INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)UpdateInstructionStats,
-                   IARG_UINT32, INS_Size(ins),
-                   IARG_UINT32, INS_OperandCount(ins),
-                   IARG_UINT32, INS_MaxNumRRegs(ins),
-                   IARG_UINT32, INS_MaxNumWRegs(ins),
-                   IARG_END);
-
-    // 9. Immediate value statistics
-    for (UINT32 op = 0; op < INS_OperandCount(ins); op++) {
-        if (INS_OperandIsImmediate(ins, op)) {
-            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FastForward, IARG_END);
-            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)UpdateImmediateStats,
-                              IARG_ADDRINT, static_cast<ADDRINT>(INS_OperandImmediate(ins, op)),
-                              IARG_END);
+            Instruction(ins, 0);
         }
     }
 }
+
 /*!
- * Insert call to the CountBbl() analysis routine before every basic block 
- * of the trace.
- * This function is called every time a new trace is encountered.
- * @param[in]   trace    trace to be instrumented
- * @param[in]   v        value specified by the tool in the TRACE_AddInstrumentFunction
- *                       function call
+ * Instrument every basic block of the trace for basic block vector collection.
+ * Used instead of Trace() when -bbv is given: the whole run is profiled and no
+ * window is measured.
  */
-VOID Trace(TRACE trace, VOID* v)
+VOID TraceBbv(TRACE trace, VOID* v)
 {
-    // Visit every basic block in the trace
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
-        // Insert a call to CountBbl() before every basic bloc, passing the number of instructions
-        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbl, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbl, IARG_REG_VALUE, tlsReg,
+                       IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+
+        std::map<ADDRINT, UINT32>::iterator it =
+            bbvBlockIds.insert(std::make_pair(BBL_Address(bbl), (UINT32)bbvBlockIds.size())).first;
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) CountBbv, IARG_REG_VALUE, tlsReg,
+                         IARG_UINT32, it->second, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) WriteBbv, IARG_REG_VALUE, tlsReg, IARG_END);
     }
 }
 
 /*!
- * Increase counter of threads in the application.
+ * Make the routine named by -roi the region of interest. It is matched by its
+ * symbol or by its undecorated C++ name. Exits that bypass the routine's
+ * returns, such as longjmp(), are not seen.
+ */
+VOID Routine(RTN rtn, VOID* v)
+{
+    const string& name = KnobRoiRoutine.Value();
+    if (RTN_Name(rtn) != name && PIN_UndecorateSymbolName(RTN_Name(rtn), UNDECORATION_NAME_ONLY) != name) return;
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) EnterRoi, IARG_REG_VALUE, tlsReg,
+                   IARG_CALL_ORDER, CALL_ORDER_FIRST, IARG_END);
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR) ExitRoi, IARG_REG_VALUE, tlsReg,
+                   IARG_CALL_ORDER, CALL_ORDER_LAST, IARG_END);
+    RTN_Close(rtn);
+}
+
+/*!
+ * Increase counter of threads in the application and give the new thread its
+ * counter block, published to the analysis routines through tlsReg.
  * This function is called for every thread created by the application when it is
  * about to start running (including the root thread).
  * @param[in]   threadIndex     ID assigned by PIN to the new thread
@@ -571,17 +3106,136 @@ VOID Trace(TRACE trace, VOID* v)
  * @param[in]   v               value specified by the tool in the 
  *                              PIN_AddThreadStartFunction function call
  */
-VOID ThreadStart(THREADID threadIndex, CONTEXT* ctxt, INT32 flags, VOID* v) { threadCount++; }
+VOID ThreadStart(THREADID threadIndex, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    // Cache-line aligned counter block with execution counter pages for all existing deltas
+    VOID* raw = malloc(sizeof(THREAD_DATA) + CACHE_LINE);
+    VOID* aligned = (VOID*)(((ADDRINT)raw + CACHE_LINE - 1) & ~(ADDRINT)(CACHE_LINE - 1));
+    THREAD_DATA* td = new (aligned) THREAD_DATA(threadIndex, footprintChunkBits);
+    if (cacheModel) {
+        UINT32 lineBits = __builtin_ctz(KnobLineSize.Value());
+        td->l1d = new CACHE(KnobL1Size.Value(), KnobL1Assoc.Value(), lineBits, KnobL1Latency.Value());
+        td->l2 = new CACHE(KnobL2Size.Value(), KnobL2Assoc.Value(), lineBits, KnobL2Latency.Value());
+    }
+    if (tlbModel) {
+        td->itlb = new CACHE((UINT64)KnobItlbEntries.Value() << pageBits, KnobItlbAssoc.Value(), pageBits, 0);
+        td->dtlb = new CACHE((UINT64)KnobDtlbEntries.Value() << pageBits, KnobDtlbAssoc.Value(), pageBits, 0);
+        td->stlb = new CACHE((UINT64)KnobStlbEntries.Value() << pageBits, KnobStlbAssoc.Value(), pageBits,
+                             KnobStlbLatency.Value());
+    }
+    UINT32 pages = (numCountDeltas + (1 << EXEC_PAGE_BITS) - 1) >> EXEC_PAGE_BITS;
+    for (UINT32 p = 0; p < pages; p++) {
+        td->execPages[p] = new UINT64[1 << EXEC_PAGE_BITS]();
+    }
+
+    if (wsLength) {
+        td->workingSet = new WORKING_SET();
+    }
+    if (strideAnalysis) {
+        td->loadPatterns = new LOAD_PATTERNS();
+    }
+    for (size_t w = 0; w < ilpWindows.size(); w++) {
+        td->dataflow.push_back(new DATAFLOW(ilpWindows[w]));
+    }
+    if (dependenceAnalysis) {
+        td->dependences = new DEPENDENCE_DISTANCES();
+    }
+    if (traceOut) {
+        td->trace = new TRACE_WRITER(threadIndex);
+    }
+    if (sketchPrecision) {
+        td->insSketch = new CHUNK_SKETCH(FOOTPRINT_BITS, sketchPrecision);
+        td->dataSketch = new CHUNK_SKETCH(FOOTPRINT_BITS, sketchPrecision);
+    }
+    for (size_t r = 0; r < reuseBlockBits.size(); r++) {
+        td->reuse.push_back(new REUSE_DISTANCE(reuseBlockBits[r]));
+    }
+    if (intervalLength) {
+        td->intervalStart = INTERVAL_RECORD();
+        td->intervalBuf = new INTERVAL_RECORD[INTERVAL_BUFFER_RECORDS];
+    }
+    if (bbvInterval) {
+        td->bbvOut = new std::ofstream((KnobBbvFile.Value() + "." + decstr(threadIndex)).c_str());
+    }
+
+    PIN_GetLock(&threadLock, threadIndex + 1);
+    threadCount++;
+    threadData.push_back(td);
+    PIN_ReleaseLock(&threadLock);
+
+    PIN_SetThreadData(tlsKey, td, threadIndex);
+    PIN_SetContextReg(ctxt, tlsReg, (ADDRINT)td);
+    if (wsLength) {
+        PIN_SetContextReg(ctxt, epochReg, 0);
+    }
+    if (phase == PHASE_SAMPLED) {
+        PIN_SetContextReg(ctxt, versionReg, VERSION_FAST);
+    }
+}
+
+/*!
+ * Write the last, partial basic block vector interval of a thread and close its file.
+ * @param[in]   threadIndex     ID assigned by PIN to the exiting thread
+ * @param[in]   ctxt            register state of the thread at exit
+ * @param[in]   code            OS specific termination code for the thread
+ * @param[in]   v               value specified by the tool in the
+ *                              PIN_AddThreadFiniFunction function call
+ */
+VOID ThreadFiniBbv(THREADID threadIndex, const CONTEXT* ctxt, INT32 code, VOID* v)
+{
+    THREAD_DATA* td = static_cast<THREAD_DATA*>(PIN_GetThreadData(tlsKey, threadIndex));
+    if (td->bbvIns) WriteBbv(td);
+    td->bbvOut->close();
+}
 
 /*!
  * Print out analysis results.
- * This function is called when the application exits.
+ * This function is called when the application exits, either on its own or
+ * through MyExitRoutine() at the end of the measured window.
  * @param[in]   code            exit code of the application
  * @param[in]   v               value specified by the tool in the 
  *                              PIN_AddFiniFunction function call
  */
 VOID Fini(INT32 code, VOID* v)
 {
+    if (intervalLength)
+    {
+        // Record the last, partial interval of every thread
+        for (size_t t = 0; t < threadData.size(); t++)
+        {
+            if (threadData[t]->intervalIns) EndInterval(threadData[t]);
+            if (threadData[t]->numIntervals % INTERVAL_BUFFER_RECORDS) FlushIntervals(threadData[t]);
+        }
+        intervalOut->close();
+    }
+    if (wsLength)
+    {
+        // Write the last window of every thread
+        for (size_t t = 0; t < threadData.size(); t++)
+        {
+            EndWorkingSetWindows(threadData[t], threadData[t]->wsWindow + 1);
+        }
+        wsOut->close();
+    }
+    if (traceOut)
+    {
+        FinishTrace();
+    }
+
+    if (windowDone || phase == PHASE_ROI || phase == PHASE_SAMPLED)
+    {
+        PrintResults();
+        return;
+    }
+
+    UINT64 insCount = 0;
+    UINT64 bblCount = 0;
+    for (size_t t = 0; t < threadData.size(); t++)
+    {
+        insCount += threadData[t]->ins;
+        bblCount += threadData[t]->bbls;
+    }
+
     *out << "===============================================" << endl;
     *out << "MyPinTool analysis results: " << endl;
     *out << "Number of instructions: " << insCount << endl;
@@ -607,20 +3261,191 @@ int main(int argc, char* argv[])
     }
 
     string fileName = KnobOutputFile.Value();
+    if (KnobTopK.Value() || !KnobRoiRoutine.Value().empty())
+    {
+        // Routine names for the hot code report and the region of interest
+        PIN_InitSymbols();
+    }
     fast_forward_count = KnobFastForward.Value() * 1e9;
-    if (!fileName.empty())
+    if (!ParseGranularities(KnobFootprintGranularity.Value(), footprintGranBits))
     {
-        out = new std::ofstream(fileName.c_str());
+        cerr << "Invalid footprint granularity list: " << KnobFootprintGranularity.Value() << endl;
+        return Usage();
+    }
+    for (size_t i = 0; i < footprintGranBits.size(); i++)
+    {
+        footprintChunkBits = std::min(footprintChunkBits, footprintGranBits[i]);
+    }
+    sketchPrecision = KnobSketch.Value();
+    if (sketchPrecision && (sketchPrecision < 4 || sketchPrecision > 18))
+    {
+        cerr << "The HyperLogLog precision must be between 4 and 18" << endl;
+        return Usage();
+    }
+    exactFootprint = !sketchPrecision || KnobSketchCheck.Value();
+    strideAnalysis = KnobStride.Value();
+    dependenceAnalysis = KnobDependences.Value();
+    if (!ParseGranularities(KnobReuse.Value(), reuseBlockBits))
+    {
+        cerr << "Invalid reuse distance block size list: " << KnobReuse.Value() << endl;
+        return Usage();
+    }
+    if (KnobIlp)
+    {
+        ilpWindows.push_back(0);
+        if (!ParseWindowSizes(KnobIlpWindows.Value(), ilpWindows))
+        {
+            cerr << "Invalid instruction window list: " << KnobIlpWindows.Value() << endl;
+            return Usage();
+        }
+    }
+
+    cacheModel = KnobCacheModel.Value();
+    if (cacheModel)
+    {
+        if (!ValidCacheGeometry(KnobL1Size.Value(), KnobL1Assoc.Value()) ||
+            !ValidCacheGeometry(KnobL2Size.Value(), KnobL2Assoc.Value()) ||
+            !ValidCacheGeometry(KnobLlcSize.Value(), KnobLlcAssoc.Value()))
+        {
+            cerr << "Cache sizes must give a power-of-two number of sets" << endl;
+            return Usage();
+        }
+        llc = new CACHE(KnobLlcSize.Value(), KnobLlcAssoc.Value(), __builtin_ctz(KnobLineSize.Value()),
+                        KnobLlcLatency.Value());
+        memLatency = KnobMemLatency.Value();
+        PIN_InitLock(&llcLock);
+    }
+
+    tlbModel = KnobTlbModel.Value();
+    if (tlbModel)
+    {
+        if (KnobPageSize.Value() != 4096 && KnobPageSize.Value() != 2097152)
+        {
+            cerr << "The TLB page size must be 4096 or 2097152 bytes" << endl;
+            return Usage();
+        }
+        if (!ValidTlbGeometry(KnobItlbEntries.Value(), KnobItlbAssoc.Value()) ||
+            !ValidTlbGeometry(KnobDtlbEntries.Value(), KnobDtlbAssoc.Value()) ||
+            !ValidTlbGeometry(KnobStlbEntries.Value(), KnobStlbAssoc.Value()))
+        {
+            cerr << "TLB entries must give a power-of-two number of sets" << endl;
+            return Usage();
+        }
+        pageBits = __builtin_ctzll(KnobPageSize.Value());
+        walkLatency = KnobWalkLatency.Value();
+    }
+
+    bbvInterval = KnobBbvInterval.Value() * 1000000;
+    intervalLength = KnobInterval.Value() * 1000000;
+    if (intervalLength && !bbvInterval)
+    {
+        intervalOut = new std::ofstream(KnobIntervalFile.Value().c_str(), std::ios::binary);
+        if (!*intervalOut)
+        {
+            cerr << "Cannot open the interval file " << KnobIntervalFile.Value() << endl;
+            return 1;
+        }
+        // The footprint columns count chunks of the bitmap, or of the sketch with -hll alone
+        UINT32 intervalChunkBits = exactFootprint ? footprintChunkBits : FOOTPRINT_BITS;
+        INTERVAL_FILE_HEADER header = { {'H', 'W', '1', 'I'}, INTERVAL_FILE_VERSION, intervalLength,
+                                        intervalChunkBits, sizeof(INTERVAL_RECORD) };
+        intervalOut->write(reinterpret_cast<const char*>(&header), sizeof(header));
+        PIN_InitLock(&intervalLock);
+    }
+    else
+    {
+        intervalLength = 0;
+    }
+
+    InitCategorySlots();
+    PIN_InitLock(&threadLock);
+    tlsReg = PIN_ClaimToolRegister();
+    if (!REG_valid(tlsReg))
+    {
+        cerr << "Cannot allocate a scratch register for the per-thread counters" << endl;
+        return 1;
     }
+    tlsKey = PIN_CreateThreadDataKey(NULL);
 
-    // Register Instruction to be called to instrument instructions
+    wsLength = bbvInterval ? 0 : KnobWorkingSet.Value() * 1000000;
+    if (wsLength)
+    {
+        epochReg = PIN_ClaimToolRegister();
+        if (!REG_valid(epochReg))
+        {
+            cerr << "Cannot allocate a scratch register for the working set windows" << endl;
+            return 1;
+        }
+        wsOut = new std::ofstream(KnobWorkingSetFile.Value().c_str());
+        *wsOut << "# thread window pages(4KB) lines(64B), " << wsLength << " instructions per window\n";
+        PIN_InitLock(&wsLock);
+    }
+
+    if (!KnobTraceFile.Value().empty() && !bbvInterval)
+    {
+        traceOut = new std::ofstream(KnobTraceFile.Value().c_str(), std::ios::binary);
+        if (!*traceOut)
+        {
+            cerr << "Cannot open the trace file " << KnobTraceFile.Value() << endl;
+            return 1;
+        }
+        TRACE_FILE_HEADER header = { {'H', 'W', '1', 'T'}, TRACE_FILE_VERSION };
+        traceOut->write(reinterpret_cast<const char*>(&header), sizeof(header));
+        PIN_InitLock(&traceLock);
+    }
 
+    memBuffer = PIN_DefineTraceBuffer(sizeof(MEM_REF), MEM_BUFFER_PAGES, MemBufferFull, 0);
+    if (memBuffer == BUFFER_ID_INVALID)
+    {
+        cerr << "Cannot allocate the memory access buffer" << endl;
+        return 1;
+    }
+    if (!KnobRoiRoutine.Value().empty() || KnobRoiMarkers)
+    {
+        phase = PHASE_ROI;
+    }
+    else if (KnobSamplePeriod.Value())
+    {
+        if (KnobSampleLength.Value() == 0 || KnobSampleLength.Value() >= KnobSamplePeriod.Value())
+        {
+            cerr << "The sample length must be positive and shorter than the sampling period" << endl;
+            return Usage();
+        }
+        versionReg = PIN_ClaimToolRegister();
+        if (!REG_valid(versionReg))
+        {
+            cerr << "Cannot allocate a scratch register for the trace versions" << endl;
+            return 1;
+        }
+        sampleLength = KnobSampleLength.Value();
+        sampleGap = KnobSamplePeriod.Value() - sampleLength;
+        phase = PHASE_SAMPLED;
+    }
+    else if (KnobTwoPhase)
+    {
+        phase = fast_forward_count ? PHASE_FAST_FORWARD : PHASE_DETAILED;
+    }
+    if (!fileName.empty())
+    {
+        out = new std::ofstream(fileName.c_str());
+    }
 
     if (KnobCount)
     {
-            INS_AddInstrumentFunction(Instruction,0);
         // Register function to be called to instrument traces
-        TRACE_AddInstrumentFunction(Trace, 0);
+        if (bbvInterval)
+        {
+            TRACE_AddInstrumentFunction(TraceBbv, 0);
+            PIN_AddThreadFiniFunction(ThreadFiniBbv, 0);
+        }
+        else
+        {
+            TRACE_AddInstrumentFunction(Trace, 0);
+            if (!KnobRoiRoutine.Value().empty())
+            {
+                RTN_AddInstrumentFunction(Routine, 0);
+            }
+        }
 
         // Register function to be called for every thread before it starts running
         PIN_AddThreadStartFunction(ThreadStart, 0);
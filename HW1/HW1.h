@@ -0,0 +1,201 @@
+/*! @file
+ *  Definitions shared by the HW1 Pin tool and the offline programs reading its
+ *  output files.
+ */
+
+#ifndef HW1_H
+#define HW1_H
+
+#include <stdint.h>
+
+// Part A counters, indexed in the order they are reported
+enum INS_TYPE
+{
+    TYPE_LOAD = 0,
+    TYPE_STORE,
+    TYPE_NOP,
+    TYPE_DIRECT_CALL,
+    TYPE_INDIRECT_CALL,
+    TYPE_RETURN,
+    TYPE_UNCOND_BR,
+    TYPE_COND_BR,
+    TYPE_LOGICAL,
+    TYPE_ROTATE_SHIFT,
+    TYPE_FLAGOP,
+    TYPE_VECTOR,
+    TYPE_CMOV,
+    TYPE_MMX_SSE,
+    TYPE_SYSCALL,
+    TYPE_FLOATING_POINT,
+    TYPE_OTHER,
+    NUM_INS_TYPES
+};
+
+static const char* const insTypeNames[NUM_INS_TYPES] = {
+    "Loads", "Stores", "NOPs", "Direct calls", "Indirect calls", "Returns",
+    "Unconditional branches", "Conditional branches", "Logical operations",
+    "Rotate and Shift", "Flag operations", "Vector instructions", "Conditional moves",
+    "MMX and SSE instructions", "System calls", "Floating point instructions", "The rest"
+};
+
+/*!
+ * Header of the interval file written with -interval.
+ */
+struct INTERVAL_FILE_HEADER
+{
+    char magic[4];            // "HW1I"
+    uint32_t version;
+    uint64_t interval;        // instructions per interval
+    uint32_t chunkBits;       // log2 of the footprint chunk size
+    uint32_t recordSize;      // sizeof(INTERVAL_RECORD)
+};
+
+static const uint32_t INTERVAL_FILE_VERSION = 1;
+
+/*!
+ * Counters of one interval of one thread inside the measured window, as
+ * differences from the end of the thread's previous interval. Records of
+ * different threads are interleaved in the file in the order their buffers
+ * were flushed.
+ */
+struct INTERVAL_RECORD
+{
+    uint32_t tid;
+    uint32_t index;                      // interval number within the thread
+    uint64_t instructions;               // instructions in the interval, less than the interval length only for the last one
+    uint64_t counts[NUM_INS_TYPES];      // Part A counters
+    uint64_t cycles;                     // Part B cycles
+    uint64_t insChunks;                  // instruction chunks touched for the first time by the thread
+    uint64_t dataChunks;                 // data chunks touched for the first time by the thread
+};
+
+/*!
+ * Trace file written with -trace. It starts with a TRACE_FILE_HEADER followed by
+ * chunks, each a TRACE_CHUNK_HEADER and its encoded records. The dictionary of
+ * instrumented blocks and the chunk index come after the last chunk and are
+ * found through the TRACE_FILE_FOOTER at the very end of the file.
+ *
+ * A chunk holds consecutive records of one thread, starts with a block record
+ * and decodes on its own. Every record starts with a varint tag:
+ *   tag & 1 == 0   execution of block tag >> 1 of the dictionary
+ *   tag & 1 == 1   instruction record of the current block with flags
+ *                  (tag >> 1) & 7 and size tag >> 4 in bytes, followed by the
+ *                  varint offset of the instruction from the block address.
+ *                  A data access (TRACE_WRITE, TRACE_CHASE) is then followed
+ *                  by the zigzag varint difference from the previous address
+ *                  of the chunk (0 at its start); a TRACE_EXEC record has no
+ *                  size and no address.
+ *
+ * The instructions of an executed block all execute once, except predicated
+ * ones (TRACE_INS_PREDICATED), which execute once per group of their data
+ * accesses, or once per TRACE_EXEC record if they have no memory operand.
+ */
+struct TRACE_FILE_HEADER
+{
+    char magic[4];            // "HW1T"
+    uint32_t version;
+};
+
+static const uint32_t TRACE_FILE_VERSION = 2;
+static const uint32_t TRACE_WRITE = 1;    // the access is a store
+static const uint32_t TRACE_CHASE = 2;    // a load whose address registers were produced by a load
+static const uint32_t TRACE_EXEC = 4;     // a predicated instruction without data access executed
+
+struct TRACE_CHUNK_HEADER
+{
+    uint32_t tid;
+    uint32_t bytes;           // size of the encoded records
+    uint64_t blocks;          // block records in the chunk
+};
+
+struct TRACE_INDEX_ENTRY
+{
+    uint64_t offset;          // file offset of the chunk's TRACE_CHUNK_HEADER
+    TRACE_CHUNK_HEADER chunk;
+};
+
+/*!
+ * Dictionary entry of an instrumented block, indexed by block id. A block
+ * instrumented more than once has several entries with the same address.
+ * Where the window can open in the middle of a block (at a region of interest
+ * start marker, or in a guarded run with several threads) the rest of the
+ * block from that point also has an entry of its own.
+ */
+struct TRACE_BLOCK
+{
+    uint64_t addr;
+    uint32_t numIns;
+    uint32_t firstIns;        // index of its first TRACE_INS
+};
+
+/*!
+ * Dictionary entry of an instruction with its Part D properties, in the order
+ * of the block's instructions. Counts are saturated at 255.
+ */
+struct TRACE_INS
+{
+    uint8_t size;             // instruction length in bytes
+    uint8_t type;             // Part A INS_TYPE of the operation
+    uint8_t flags;            // TRACE_INS_PREDICATED, TRACE_INS_IMM, TRACE_INS_DISP
+    uint8_t operands;
+    uint8_t regReads;
+    uint8_t regWrites;
+    uint8_t memOperands;
+    uint8_t memReads;         // memory operands read, each recorded as one access per execution
+    uint8_t memWrites;        // memory operands written, each recorded as one access per execution
+    uint32_t memBytes;        // bytes of all memory operands
+    int32_t minImm;           // immediates as signed 32-bit values, if TRACE_INS_IMM
+    int32_t maxImm;
+    int64_t minDisp;          // displacements of the memory operands, if TRACE_INS_DISP
+    int64_t maxDisp;
+};
+
+static const uint32_t TRACE_INS_PREDICATED = 1;   // may execute any number of times per block execution
+static const uint32_t TRACE_INS_IMM = 2;          // has immediate operands
+static const uint32_t TRACE_INS_DISP = 4;         // has memory operands, whose displacements are given
+
+struct TRACE_FILE_FOOTER
+{
+    uint64_t blocksOffset;    // TRACE_BLOCK array
+    uint64_t numBlocks;
+    uint64_t insOffset;       // TRACE_INS array
+    uint64_t numIns;
+    uint64_t indexOffset;     // TRACE_INDEX_ENTRY array, in file order
+    uint64_t numChunks;
+    char magic[4];            // "HW1T"
+    uint32_t version;
+};
+
+// Longest varint of a 64-bit value
+static const uint32_t MAX_VARINT_BYTES = 10;
+
+// Write v as a little-endian base-128 varint, returning the end of the encoding
+static inline uint8_t* PutVarint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Read a varint, returning the end of the encoding or 0 if it runs past end
+static inline const uint8_t* GetVarint(const uint8_t* p, const uint8_t* end, uint64_t* v)
+{
+    *v = 0;
+    for (uint32_t shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *p++;
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return p;
+    }
+    return 0;
+}
+
+// Map signed differences to unsigned values with small magnitudes first: 0, -1, 1, -2, ...
+static inline uint64_t ZigZag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t UnZigZag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+#endif
@@ -0,0 +1,72 @@
+/*! @file
+ *  Reader for the interval file written by HW1 -interval. Prints one
+ *  comma-separated line per interval, ordered by thread and interval number,
+ *  with the Part A counters, the CPI and the newly touched footprint chunks.
+ *
+ *  Usage: intervals <interval file>
+ */
+
+#include "HW1.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+using std::cerr;
+using std::endl;
+
+static bool RecordOrder(const INTERVAL_RECORD& a, const INTERVAL_RECORD& b)
+{
+    return a.tid != b.tid ? a.tid < b.tid : a.index < b.index;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        cerr << "Usage: intervals <interval file>" << endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    INTERVAL_FILE_HEADER header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, "HW1I", 4))
+    {
+        cerr << argv[1] << " is not an interval file" << endl;
+        return 1;
+    }
+    if (header.version != INTERVAL_FILE_VERSION || header.recordSize != sizeof(INTERVAL_RECORD))
+    {
+        cerr << argv[1] << " was written by a different version of HW1" << endl;
+        return 1;
+    }
+
+    std::vector<INTERVAL_RECORD> records;
+    INTERVAL_RECORD next;
+    while (in.read(reinterpret_cast<char*>(&next), sizeof(next)))
+    {
+        records.push_back(next);
+    }
+    std::sort(records.begin(), records.end(), RecordOrder);
+
+    std::cout << "# interval " << header.interval << " instructions, footprint chunk "
+              << (1ULL << header.chunkBits) << " bytes\n";
+    std::cout << "tid,index,instructions";
+    for (uint32_t i = 0; i < NUM_INS_TYPES; i++) std::cout << "," << insTypeNames[i];
+    std::cout << ",cycles,CPI,instruction chunks,data chunks\n";
+
+    for (size_t r = 0; r < records.size(); r++)
+    {
+        const INTERVAL_RECORD& rec = records[r];
+        uint64_t total = 0;
+        std::cout << rec.tid << "," << rec.index << "," << rec.instructions;
+        for (uint32_t i = 0; i < NUM_INS_TYPES; i++)
+        {
+            std::cout << "," << rec.counts[i];
+            total += rec.counts[i];
+        }
+        std::cout << "," << rec.cycles << "," << (total ? (double)rec.cycles / total : 0)
+                  << "," << rec.insChunks << "," << rec.dataChunks << "\n";
+    }
+    return 0;
+}
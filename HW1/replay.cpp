@@ -0,0 +1,405 @@
+/*! @file
+ *  Native replay of a trace recorded with HW1 -trace. The trace file is
+ *  memory-mapped and its chunks, which decode independently, are handed out to
+ *  worker threads. Each worker runs the analyses the trace supports on its
+ *  chunks: the Part A instruction mix, the Part B CPI, the Part C 32-byte
+ *  footprints and the Part D statistics, taken from the dictionary and weighted
+ *  by the executions the records show, as HW1 does. The per-worker statistics
+ *  are then merged and printed in the format of HW1.
+ *
+ *  Usage: replay <trace file> [-j threads]
+ */
+
+#include "HW1.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+using std::cerr;
+using std::endl;
+
+// Part B latencies and Part C/D parameters of HW1
+static const uint32_t MEM_OP_LATENCY = 70;
+static const uint32_t INS_LATENCY = 1;
+static const uint32_t FOOTPRINT_BITS = 5;
+static const uint32_t MAX_INS_LENGTH = 15;
+static const uint32_t OPERAND_BUCKETS = 16;
+static const uint32_t MEM_OPERAND_BUCKETS = 8;
+
+/*!
+ * The mapped trace file and the parts of it located through the footer.
+ */
+struct TRACE
+{
+    const uint8_t* data;
+    size_t size;
+    const TRACE_BLOCK* blocks;
+    uint64_t numBlocks;
+    const TRACE_INS* ins;
+    uint64_t numIns;
+    const TRACE_INDEX_ENTRY* index;
+    uint64_t numChunks;
+    std::vector<uint32_t> insOffset;    // offset of every TRACE_INS from its block address
+};
+
+/*!
+ * Statistics of one worker. Histograms have one bucket per value below their
+ * size and an overflow bucket, as in HW1.
+ */
+struct STATS
+{
+    uint64_t counts[NUM_INS_TYPES];
+    uint64_t cycles;
+    uint64_t blocks;
+    uint64_t insLength[MAX_INS_LENGTH + 2];
+    uint64_t operands[OPERAND_BUCKETS + 1];
+    uint64_t regReads[OPERAND_BUCKETS + 1];
+    uint64_t regWrites[OPERAND_BUCKETS + 1];
+    uint64_t memOps[MEM_OPERAND_BUCKETS + 1];
+    uint64_t memReads[MEM_OPERAND_BUCKETS + 1];
+    uint64_t memWrites[MEM_OPERAND_BUCKETS + 1];
+    uint64_t maxMemBytes;
+    uint64_t totalMemBytes;
+    uint64_t memInsCount;
+    int32_t maxImm;
+    int32_t minImm;
+    int64_t maxDisp;
+    int64_t minDisp;
+    std::unordered_set<uint64_t> insChunks;
+    std::unordered_set<uint64_t> dataChunks;
+    std::vector<bool> blockSeen;        // blocks whose instruction chunks are already in insChunks
+    bool corrupt;
+};
+
+template <uint32_t N>
+static void Add(uint64_t (&hist)[N], uint32_t value)
+{
+    hist[std::min(value, N - 1)]++;
+}
+
+/*!
+ * Count one execution of an instruction with a true predicate: its Part A
+ * operation and its memory operand, bytes and displacement statistics. The
+ * load and store micro-ops are counted from the data access records.
+ */
+static void RetireIns(const TRACE_INS& ins, STATS& stats)
+{
+    stats.counts[std::min<uint32_t>(ins.type, TYPE_OTHER)]++;
+    stats.cycles += INS_LATENCY;
+    Add(stats.memOps, ins.memReads + ins.memWrites);
+    if (ins.memOperands)
+    {
+        Add(stats.memReads, ins.memReads);
+        Add(stats.memWrites, ins.memWrites);
+        stats.maxMemBytes = std::max<uint64_t>(stats.maxMemBytes, ins.memBytes);
+        stats.totalMemBytes += ins.memBytes;
+        stats.memInsCount++;
+    }
+    if (ins.flags & TRACE_INS_DISP)
+    {
+        stats.maxDisp = std::max(stats.maxDisp, ins.maxDisp);
+        stats.minDisp = std::min(stats.minDisp, ins.minDisp);
+    }
+}
+
+/*!
+ * Count one execution of a block: the length, operand and immediate statistics
+ * of all its instructions, whatever their predicate, and the retirement of the
+ * instructions that are not predicated.
+ */
+static void ExecuteBlock(const TRACE& trace, const TRACE_BLOCK& block, STATS& stats)
+{
+    for (uint32_t k = 0; k < block.numIns; k++)
+    {
+        const TRACE_INS& ins = trace.ins[block.firstIns + k];
+        Add(stats.insLength, ins.size);
+        Add(stats.operands, ins.operands);
+        Add(stats.regReads, ins.regReads);
+        Add(stats.regWrites, ins.regWrites);
+        if (ins.flags & TRACE_INS_IMM)
+        {
+            stats.maxImm = std::max(stats.maxImm, ins.maxImm);
+            stats.minImm = std::min(stats.minImm, ins.minImm);
+        }
+        if (!(ins.flags & TRACE_INS_PREDICATED)) RetireIns(ins, stats);
+    }
+}
+
+// Add the instruction footprint of a block the first time the worker executes it
+static void TouchBlock(const TRACE& trace, uint64_t id, STATS& stats)
+{
+    if (stats.blockSeen[id]) return;
+    stats.blockSeen[id] = true;
+    const TRACE_BLOCK& block = trace.blocks[id];
+    for (uint32_t k = 0; k < block.numIns; k++)
+    {
+        uint64_t addr = block.addr + trace.insOffset[block.firstIns + k];
+        uint32_t size = std::max<uint32_t>(trace.ins[block.firstIns + k].size, 1);
+        for (uint64_t c = addr >> FOOTPRINT_BITS; c <= (addr + size - 1) >> FOOTPRINT_BITS; c++)
+            stats.insChunks.insert(c);
+    }
+}
+
+/*!
+ * Decode one chunk and run the analyses over its records.
+ * @return false if the chunk is malformed
+ */
+static bool ReplayChunk(const TRACE& trace, const TRACE_INDEX_ENTRY& entry, STATS& stats)
+{
+    const uint8_t* p = trace.data + entry.offset + sizeof(TRACE_CHUNK_HEADER);
+    const uint8_t* end = p + entry.chunk.bytes;
+    const TRACE_BLOCK* block = NULL;
+    uint32_t cursor = 0;              // instruction of the block the next record may belong to
+    uint32_t pending = 0;             // accesses of the current execution of a predicated instruction at cursor
+    uint64_t lastEa = 0;
+
+    while (p < end)
+    {
+        uint64_t tag;
+        if (!(p = GetVarint(p, end, &tag))) return false;
+        if (!(tag & 1))
+        {
+            if (pending) RetireIns(trace.ins[block->firstIns + cursor], stats);
+            pending = 0;
+            if ((tag >> 1) >= trace.numBlocks) return false;
+            block = &trace.blocks[tag >> 1];
+            cursor = 0;
+            stats.blocks++;
+            ExecuteBlock(trace, *block, stats);
+            TouchBlock(trace, tag >> 1, stats);
+            continue;
+        }
+
+        uint64_t offset, delta = 0;
+        bool exec = (tag >> 1) & TRACE_EXEC;
+        if (!block || !(p = GetVarint(p, end, &offset)) || (!exec && !(p = GetVarint(p, end, &delta)))) return false;
+        for (; cursor < block->numIns && trace.insOffset[block->firstIns + cursor] < offset; cursor++)
+        {
+            if (pending) RetireIns(trace.ins[block->firstIns + cursor], stats);
+            pending = 0;
+        }
+        if (cursor == block->numIns || trace.insOffset[block->firstIns + cursor] != offset) return false;
+
+        // A predicated instruction executes once per group of its accesses, e.g. per REP iteration
+        const TRACE_INS& ins = trace.ins[block->firstIns + cursor];
+        bool predicated = ins.flags & TRACE_INS_PREDICATED;
+        if (exec)
+        {
+            if (!predicated || pending) return false;
+            RetireIns(ins, stats);
+            continue;
+        }
+        if (predicated && ++pending >= (uint32_t)ins.memReads + ins.memWrites)
+        {
+            RetireIns(ins, stats);
+            pending = 0;
+        }
+
+        lastEa += UnZigZag(delta);
+        uint32_t size = tag >> 4;
+        uint32_t ops = (size + 3) / 4;
+        bool write = (tag >> 1) & TRACE_WRITE;
+        stats.counts[write ? TYPE_STORE : TYPE_LOAD] += ops;
+        stats.cycles += (uint64_t)ops * MEM_OP_LATENCY;
+        for (uint64_t c = lastEa >> FOOTPRINT_BITS; size && c <= (lastEa + size - 1) >> FOOTPRINT_BITS; c++)
+            stats.dataChunks.insert(c);
+    }
+    if (pending) RetireIns(trace.ins[block->firstIns + cursor], stats);
+    return true;
+}
+
+// Worker loop: replay the next unclaimed chunk until there is none left
+static void Worker(const TRACE* trace, std::atomic<uint64_t>* next, STATS* stats)
+{
+    stats->blockSeen.assign(trace->numBlocks, false);
+    stats->maxImm = INT32_MIN;
+    stats->minImm = INT32_MAX;
+    stats->maxDisp = INT64_MIN;
+    stats->minDisp = INT64_MAX;
+    for (uint64_t c = (*next)++; c < trace->numChunks; c = (*next)++)
+    {
+        if (!ReplayChunk(*trace, trace->index[c], *stats)) stats->corrupt = true;
+    }
+}
+
+/*!
+ * Map a trace file and locate its dictionary and chunk index.
+ * @return false if the file cannot be mapped or is not a complete trace
+ */
+static bool MapTrace(const char* fileName, TRACE& trace)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(TRACE_FILE_HEADER) + sizeof(TRACE_FILE_FOOTER))
+    {
+        close(fd);
+        return false;
+    }
+    trace.size = st.st_size;
+    void* data = mmap(NULL, trace.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    trace.data = static_cast<const uint8_t*>(data);
+
+    TRACE_FILE_FOOTER footer;
+    memcpy(&footer, trace.data + trace.size - sizeof(footer), sizeof(footer));
+    size_t limit = trace.size - sizeof(footer);
+    if (memcmp(trace.data, "HW1T", 4) || memcmp(footer.magic, "HW1T", 4) || footer.version != TRACE_FILE_VERSION ||
+        footer.blocksOffset + footer.numBlocks * sizeof(TRACE_BLOCK) > limit ||
+        footer.insOffset + footer.numIns * sizeof(TRACE_INS) > limit ||
+        footer.indexOffset + footer.numChunks * sizeof(TRACE_INDEX_ENTRY) > limit)
+    {
+        return false;
+    }
+    trace.blocks = reinterpret_cast<const TRACE_BLOCK*>(trace.data + footer.blocksOffset);
+    trace.numBlocks = footer.numBlocks;
+    trace.ins = reinterpret_cast<const TRACE_INS*>(trace.data + footer.insOffset);
+    trace.numIns = footer.numIns;
+    trace.index = reinterpret_cast<const TRACE_INDEX_ENTRY*>(trace.data + footer.indexOffset);
+    trace.numChunks = footer.numChunks;
+
+    for (uint64_t c = 0; c < trace.numChunks; c++)
+    {
+        if (trace.index[c].offset + sizeof(TRACE_CHUNK_HEADER) + trace.index[c].chunk.bytes > footer.blocksOffset)
+            return false;
+    }
+    trace.insOffset.assign(trace.numIns, 0);
+    for (uint64_t b = 0; b < trace.numBlocks; b++)
+    {
+        const TRACE_BLOCK& block = trace.blocks[b];
+        if ((uint64_t)block.firstIns + block.numIns > trace.numIns) return false;
+        uint32_t offset = 0;
+        for (uint32_t k = 0; k < block.numIns; k++)
+        {
+            trace.insOffset[block.firstIns + k] = offset;
+            offset += trace.ins[block.firstIns + k].size;
+        }
+    }
+    return true;
+}
+
+// Add the statistics of another worker
+static void Merge(STATS& total, const STATS& other)
+{
+    for (uint32_t i = 0; i < NUM_INS_TYPES; i++) total.counts[i] += other.counts[i];
+    total.cycles += other.cycles;
+    total.blocks += other.blocks;
+    for (uint32_t i = 0; i < MAX_INS_LENGTH + 2; i++) total.insLength[i] += other.insLength[i];
+    for (uint32_t i = 0; i <= OPERAND_BUCKETS; i++)
+    {
+        total.operands[i] += other.operands[i];
+        total.regReads[i] += other.regReads[i];
+        total.regWrites[i] += other.regWrites[i];
+    }
+    for (uint32_t i = 0; i <= MEM_OPERAND_BUCKETS; i++)
+    {
+        total.memOps[i] += other.memOps[i];
+        total.memReads[i] += other.memReads[i];
+        total.memWrites[i] += other.memWrites[i];
+    }
+    total.maxMemBytes = std::max(total.maxMemBytes, other.maxMemBytes);
+    total.totalMemBytes += other.totalMemBytes;
+    total.memInsCount += other.memInsCount;
+    total.maxImm = std::max(total.maxImm, other.maxImm);
+    total.minImm = std::min(total.minImm, other.minImm);
+    total.maxDisp = std::max(total.maxDisp, other.maxDisp);
+    total.minDisp = std::min(total.minDisp, other.minDisp);
+    total.insChunks.insert(other.insChunks.begin(), other.insChunks.end());
+    total.dataChunks.insert(other.dataChunks.begin(), other.dataChunks.end());
+    total.corrupt |= other.corrupt;
+}
+
+template <uint32_t N>
+static void PrintHistogram(const char* title, const uint64_t (&hist)[N], uint32_t maxShown)
+{
+    std::cout << title << "\n";
+    for (uint32_t i = 0; i <= maxShown; i++) std::cout << i << " : " << (i < N - 1 ? hist[i] : 0) << "\n";
+    if (hist[N - 1]) std::cout << ">=" << N - 1 << " : " << hist[N - 1] << "\n";
+    std::cout << "\n";
+}
+
+static int Usage()
+{
+    cerr << "Usage: replay <trace file> [-j threads]" << endl;
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2 && argc != 4) return Usage();
+    uint32_t numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    if (argc == 4)
+    {
+        if (strcmp(argv[2], "-j") || atoi(argv[3]) <= 0) return Usage();
+        numWorkers = atoi(argv[3]);
+    }
+
+    TRACE trace;
+    if (!MapTrace(argv[1], trace))
+    {
+        cerr << argv[1] << " is not a complete trace file" << endl;
+        return 1;
+    }
+
+    numWorkers = std::max<uint64_t>(1, std::min<uint64_t>(numWorkers, trace.numChunks));
+    std::vector<STATS> stats(numWorkers);
+    std::vector<std::thread> workers;
+    std::atomic<uint64_t> next(0);
+    for (uint32_t w = 0; w < numWorkers; w++)
+    {
+        workers.push_back(std::thread(Worker, &trace, &next, &stats[w]));
+    }
+    for (uint32_t w = 0; w < numWorkers; w++) workers[w].join();
+
+    STATS& total = stats[0];
+    for (uint32_t w = 1; w < numWorkers; w++) Merge(total, stats[w]);
+    if (total.corrupt)
+    {
+        cerr << argv[1] << " has malformed chunks" << endl;
+        return 1;
+    }
+
+    uint64_t totalExecuted = 0;
+    for (uint32_t i = 0; i < NUM_INS_TYPES; i++) totalExecuted += total.counts[i];
+
+    std::cout << "===============================================\n";
+    std::cout << "Trace chunks: " << trace.numChunks << " blocks executed: " << total.blocks
+              << " workers: " << numWorkers << "\n";
+    std::cout << "Instruction Type Results: \n";
+    for (uint32_t i = 0; i < NUM_INS_TYPES; i++)
+    {
+        std::cout << insTypeNames[i] << ": " << total.counts[i] << " ("
+                  << (float)total.counts[i] / totalExecuted << ")\n";
+    }
+    std::cout << "CPI: " << (float)total.cycles / totalExecuted << "\n\n";
+
+    PrintHistogram("Instruction Size Results: ", total.insLength, 19);
+    PrintHistogram("Memory Instruction Operand Results: ", total.memOps, 4);
+    PrintHistogram("Memory Instruction Read Operand Results: ", total.memReads, 4);
+    PrintHistogram("Memory Instruction Write Operand Results: ", total.memWrites, 4);
+    PrintHistogram("Instruction Operand Results: ", total.operands, 9);
+    PrintHistogram("Instruction Register Read Operand Results: ", total.regReads, 9);
+    PrintHistogram("Instruction Register Write Operand Results: ", total.regWrites, 9);
+
+    std::cout << "Instruction Blocks Accesses : " << total.insChunks.size() << "\n";
+    std::cout << "Memory Blocks Accesses : " << total.dataChunks.size() << "\n";
+    std::cout << "Maximum number of bytes touched by an instruction : " << total.maxMemBytes << "\n";
+    std::cout << "Average number of bytes touched by an instruction : "
+              << (total.memInsCount ? (double)total.totalMemBytes / total.memInsCount : 0) << "\n";
+    std::cout << "Maximum value of immediate : " << total.maxImm << "\n";
+    std::cout << "Minimum value of immediate : " << total.minImm << "\n";
+    std::cout << "Maximum value of displacement used in memory addressing : " << total.maxDisp << "\n";
+    std::cout << "Minimum value of displacement used in memory addressing : " << total.minDisp << "\n";
+    std::cout << "===============================================\n";
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*! @file
+ *  Offline SimPoint-style clusterer for the basic block vectors written by
+ *  HW1 -bbv. The vectors are normalized, reduced with a random projection and
+ *  clustered with k-means for every k up to -k; the smallest k whose BIC score
+ *  comes close enough to the best one is kept. For each cluster the interval
+ *  closest to its centroid is printed together with the fraction of the
+ *  executed instructions the cluster stands for, so that a few short windows
+ *  can be measured and weighted instead of one long arbitrary window.
+ *
+ *  Usage: simpoint <bbv file> [-k max clusters] [-dim dimensions] [-iters n]
+ *                  [-seed n] [-bic threshold]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+using std::cerr;
+using std::endl;
+using std::string;
+
+/*!
+ * One interval of the profile: the sparse basic block vector and the number of
+ * instructions it covers.
+ */
+struct INTERVAL
+{
+    std::vector<std::pair<uint32_t, uint64_t> > blocks;   // (block id, instructions)
+    uint64_t instructions;
+    uint64_t start;                                       // instructions executed before the interval
+};
+
+/*!
+ * Clustering of all intervals for one value of k.
+ */
+struct CLUSTERING
+{
+    std::vector<uint32_t> assignment;   // cluster of each interval
+    std::vector<double> centroids;      // k rows of dim values
+    double bic;
+};
+
+static uint32_t maxK = 10;
+static uint32_t dim = 15;
+static uint32_t maxIters = 100;
+static uint64_t seed = 1;
+static double bicThreshold = 0.9;
+
+/*!
+ * SplitMix64 step, used both as the random number generator and to derive the
+ * projection matrix entries from the block id without storing the matrix.
+ */
+static uint64_t Mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform value in [0, 1)
+static double Uniform(uint64_t& state)
+{
+    state = Mix(state);
+    return (state >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*!
+ * Read a SimPoint frequency vector file, one "T:<id>:<count> ..." line per interval.
+ * @return FALSE if the file cannot be opened or a line is malformed
+ */
+static bool ReadIntervals(const char* fileName, std::vector<INTERVAL>& intervals)
+{
+    std::ifstream in(fileName);
+    if (!in) return false;
+
+    string line;
+    uint64_t start = 0;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] != 'T') continue;
+        INTERVAL interval;
+        interval.instructions = 0;
+        interval.start = start;
+        const char* p = line.c_str() + 1;
+        while (*p == ':')
+        {
+            char* end;
+            unsigned long long id = strtoull(p + 1, &end, 10);
+            if (*end != ':' || id == 0) return false;
+            unsigned long long count = strtoull(end + 1, &end, 10);
+            interval.blocks.push_back(std::make_pair((uint32_t)id, (uint64_t)count));
+            interval.instructions += count;
+            p = end;
+            while (*p == ' ') p++;
+        }
+        if (*p != '\0') return false;
+        start += interval.instructions;
+        intervals.push_back(interval);
+    }
+    return true;
+}
+
+/*!
+ * Normalize each interval to block frequencies and project it onto dim random
+ * directions. Entry (id, j) of the projection matrix is uniform in [-1, 1].
+ * @return the projected points, one row of dim values per interval
+ */
+static std::vector<double> Project(const std::vector<INTERVAL>& intervals)
+{
+    std::vector<double> points(intervals.size() * dim, 0.0);
+    for (size_t i = 0; i < intervals.size(); i++)
+    {
+        const INTERVAL& interval = intervals[i];
+        if (interval.instructions == 0) continue;
+        double* point = &points[i * dim];
+        for (size_t b = 0; b < interval.blocks.size(); b++)
+        {
+            double freq = (double)interval.blocks[b].second / interval.instructions;
+            uint64_t state = Mix(seed ^ ((uint64_t)interval.blocks[b].first << 20));
+            for (uint32_t j = 0; j < dim; j++)
+            {
+                point[j] += freq * (2.0 * Uniform(state) - 1.0);
+            }
+        }
+    }
+    return points;
+}
+
+static double Distance2(const double* a, const double* b)
+{
+    double d = 0;
+    for (uint32_t j = 0; j < dim; j++) d += (a[j] - b[j]) * (a[j] - b[j]);
+    return d;
+}
+
+/*!
+ * Bayesian information criterion of a clustering under the identical spherical
+ * Gaussian model of X-means (Pelleg and Moore), as used by SimPoint.
+ */
+static double Bic(const std::vector<double>& points, const CLUSTERING& c, uint32_t k)
+{
+    size_t n = points.size() / dim;
+    std::vector<size_t> sizes(k, 0);
+    double sse = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sizes[c.assignment[i]]++;
+        sse += Distance2(&points[i * dim], &c.centroids[c.assignment[i] * dim]);
+    }
+    if (n <= k) return 0;
+
+    double variance = std::max(sse / (n - k) / dim, 1e-12);
+    double logLikelihood = 0;
+    for (uint32_t c2 = 0; c2 < k; c2++)
+    {
+        double rn = sizes[c2];
+        if (rn == 0) continue;
+        logLikelihood += rn * std::log(rn / n)
+                       - rn * dim / 2.0 * std::log(2 * M_PI * variance)
+                       - (rn - 1) * dim / 2.0;
+    }
+    double parameters = (k - 1) + (double)k * dim + 1;
+    return logLikelihood - parameters / 2.0 * std::log((double)n);
+}
+
+/*!
+ * Lloyd's k-means with k-means++ seeding.
+ */
+static CLUSTERING KMeans(const std::vector<double>& points, uint32_t k)
+{
+    size_t n = points.size() / dim;
+    uint64_t state = Mix(seed + k);
+    CLUSTERING c;
+    c.assignment.assign(n, 0);
+    c.centroids.assign((size_t)k * dim, 0.0);
+
+    // k-means++: pick each further centroid with probability proportional to
+    // its squared distance from the closest centroid chosen so far
+    std::vector<double> closest(n, std::numeric_limits<double>::max());
+    size_t pick = (size_t)(Uniform(state) * n);
+    for (uint32_t c2 = 0; c2 < k; c2++)
+    {
+        std::copy(&points[pick * dim], &points[pick * dim] + dim, &c.centroids[c2 * dim]);
+        double total = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            closest[i] = std::min(closest[i], Distance2(&points[i * dim], &c.centroids[c2 * dim]));
+            total += closest[i];
+        }
+        double target = Uniform(state) * total;
+        for (pick = 0; pick + 1 < n && target >= closest[pick]; pick++) target -= closest[pick];
+    }
+
+    for (uint32_t iter = 0; iter < maxIters; iter++)
+    {
+        bool changed = (iter == 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t best = 0;
+            double bestDist = std::numeric_limits<double>::max();
+            for (uint32_t c2 = 0; c2 < k; c2++)
+            {
+                double d = Distance2(&points[i * dim], &c.centroids[c2 * dim]);
+                if (d < bestDist) { bestDist = d; best = c2; }
+            }
+            if (c.assignment[i] != best) { c.assignment[i] = best; changed = true; }
+        }
+        if (!changed) break;
+
+        // Empty clusters keep their previous centroid
+        std::vector<double> sums((size_t)k * dim, 0.0);
+        std::vector<size_t> sizes(k, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            sizes[c.assignment[i]]++;
+            for (uint32_t j = 0; j < dim; j++) sums[c.assignment[i] * dim + j] += points[i * dim + j];
+        }
+        for (uint32_t c2 = 0; c2 < k; c2++)
+        {
+            if (sizes[c2] == 0) continue;
+            for (uint32_t j = 0; j < dim; j++) c.centroids[c2 * dim + j] = sums[c2 * dim + j] / sizes[c2];
+        }
+    }
+    c.bic = Bic(points, c, k);
+    return c;
+}
+
+static int Usage()
+{
+    cerr << "Usage: simpoint <bbv file> [-k max clusters] [-dim dimensions] [-iters n]" << endl
+         << "                [-seed n] [-bic threshold]" << endl;
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) return Usage();
+    for (int i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc) return Usage();
+        const char* value = argv[++i];
+        if (!strcmp(argv[i - 1], "-k")) maxK = atoi(value);
+        else if (!strcmp(argv[i - 1], "-dim")) dim = atoi(value);
+        else if (!strcmp(argv[i - 1], "-iters")) maxIters = atoi(value);
+        else if (!strcmp(argv[i - 1], "-seed")) seed = strtoull(value, NULL, 0);
+        else if (!strcmp(argv[i - 1], "-bic")) bicThreshold = atof(value);
+        else return Usage();
+    }
+    if (maxK == 0 || dim == 0) return Usage();
+
+    std::vector<INTERVAL> intervals;
+    if (!ReadIntervals(argv[1], intervals))
+    {
+        cerr << "Cannot read basic block vectors from " << argv[1] << endl;
+        return 1;
+    }
+    if (intervals.empty())
+    {
+        cerr << "No intervals in " << argv[1] << endl;
+        return 1;
+    }
+
+    std::vector<double> points = Project(intervals);
+    maxK = std::min<uint32_t>(maxK, intervals.size());
+
+    std::vector<CLUSTERING> clusterings;
+    double minBic = std::numeric_limits<double>::max();
+    double maxBic = -std::numeric_limits<double>::max();
+    for (uint32_t k = 1; k <= maxK; k++)
+    {
+        clusterings.push_back(KMeans(points, k));
+        minBic = std::min(minBic, clusterings.back().bic);
+        maxBic = std::max(maxBic, clusterings.back().bic);
+    }
+
+    uint32_t k = 1;
+    while (k < maxK && clusterings[k - 1].bic < minBic + bicThreshold * (maxBic - minBic)) k++;
+    const CLUSTERING& c = clusterings[k - 1];
+
+    // Representative interval and instruction weight of every cluster
+    std::vector<size_t> representative(k, intervals.size());
+    std::vector<double> bestDist(k, std::numeric_limits<double>::max());
+    std::vector<uint64_t> clusterIns(k, 0);
+    uint64_t totalIns = 0;
+    for (size_t i = 0; i < intervals.size(); i++)
+    {
+        uint32_t c2 = c.assignment[i];
+        double d = Distance2(&points[i * dim], &c.centroids[c2 * dim]);
+        if (d < bestDist[c2]) { bestDist[c2] = d; representative[c2] = i; }
+        clusterIns[c2] += intervals[i].instructions;
+        totalIns += intervals[i].instructions;
+    }
+
+    std::cout << "Intervals: " << intervals.size() << "\n";
+    std::cout << "Clusters: " << k << "\n";
+    for (uint32_t c2 = 0; c2 < k; c2++)
+    {
+        if (representative[c2] == intervals.size()) continue;
+        const INTERVAL& interval = intervals[representative[c2]];
+        std::cout << "Cluster " << c2
+                  << " interval " << representative[c2]
+                  << " start " << interval.start
+                  << " length " << interval.instructions
+                  << " weight " << (totalIns ? (double)clusterIns[c2] / totalIns : 0) << "\n";
+    }
+    return 0;
+}